@@ -18,6 +18,7 @@
 #include "libisp/data.h"
 #include "libisp/mem.h"
 #include "libisp/builtin.h"
+#include "libisp/image.h"
 #include "libisp/thread.h"
 
 #endif
@@ -20,8 +20,9 @@
 void lisp_add_prim_proc(char *name, lisp_prim_proc proc, lisp_ctx_t *context);
 void lisp_add_cvar(const char *name, const size_t *valptr, const int access, lisp_ctx_t *context);
 void lisp_setup_env(lisp_ctx_t *context);
+int lisp_load_image(const char *path, lisp_ctx_t *context);
 void lisp_free_context(lisp_ctx_t *context);
-lisp_ctx_t *lisp_make_context(const size_t mem_lim_soft, const size_t mem_lim_hard, const size_t mem_verbosity, const size_t thread_timeout);
+lisp_ctx_t *lisp_make_context(const size_t mem_lim_soft, const size_t mem_lim_hard, const size_t mem_verbosity, const size_t thread_timeout, const size_t gc_threads);
 void lisp_destroy_context(lisp_ctx_t *context);
 
 #endif
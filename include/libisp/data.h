@@ -17,13 +17,21 @@
 lisp_data_t *lisp_make_int(const int i, lisp_ctx_t *context);
 lisp_data_t *lisp_make_decimal(const double d, lisp_ctx_t *context);
 lisp_data_t *lisp_make_string(const char *str, lisp_ctx_t *context);
+lisp_data_t *lisp_make_string_n(const char *str, const size_t length, lisp_ctx_t *context);
 lisp_data_t *lisp_make_symbol(const char *ident, lisp_ctx_t *context);
+lisp_data_t *lisp_make_symbol_n(const char *ident, const size_t length, lisp_ctx_t *context);
 lisp_data_t *lisp_make_prim(lisp_prim_proc in, lisp_ctx_t *context);
+lisp_data_t *lisp_make_lexical(const unsigned int depth, const unsigned int slot, const lisp_data_t *symbol, lisp_ctx_t *context);
 lisp_data_t *lisp_make_error(const char *error, lisp_ctx_t *context);
+lisp_data_t *lisp_make_global(const lisp_data_t *symbol, lisp_ctx_t *context);
+lisp_data_t *lisp_make_frame(const lisp_data_t *vars, const size_t n, lisp_ctx_t *context);
+lisp_data_t *lisp_make_closure(const lisp_data_t *lambda, const lisp_data_t *env, lisp_ctx_t *context);
+lisp_data_t *lisp_make_node(const unsigned int kind, const lisp_data_t *a, const lisp_data_t *b, lisp_ctx_t *context);
 
-#define lisp_cons(l, r) lisp_cons_in_context(l, r, context)
+#define lisp_cons(l, r) lisp_cons_at(l, r, __FILE__, __LINE__, context)
 
 lisp_data_t *lisp_cons_in_context(const lisp_data_t *l, const lisp_data_t *r, lisp_ctx_t *context);
+lisp_data_t *lisp_cons_at(const lisp_data_t *l, const lisp_data_t *r, const char *file, const int line, lisp_ctx_t *context);
 lisp_data_t *lisp_car(const lisp_data_t *in);
 lisp_data_t *lisp_cdr(const lisp_data_t *in);
 
@@ -32,8 +40,10 @@ int lisp_list_length(const lisp_data_t *list);
 
 lisp_data_t *lisp_set_car(lisp_data_t *pair, const lisp_data_t *val);
 lisp_data_t *lisp_set_cdr(lisp_data_t *pair, const lisp_data_t *val);
+lisp_data_t *lisp_frame_set(lisp_data_t *frame, const unsigned int slot, const lisp_data_t *val);
+lisp_data_t *lisp_frame_add(lisp_data_t *frame, lisp_data_t *var, const lisp_data_t *val, lisp_ctx_t *context);
 
-lisp_data_t *lisp_make_copy(const lisp_data_t *in);
-lisp_data_t *lisp_append(const lisp_data_t *list1, const lisp_data_t *list2);
+lisp_data_t *lisp_make_copy(const lisp_data_t *in, lisp_ctx_t *context);
+lisp_data_t *lisp_append(const lisp_data_t *list1, const lisp_data_t *list2, lisp_ctx_t *context);
 
 #endif
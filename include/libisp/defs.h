@@ -12,6 +12,7 @@
 #ifndef LISP_DEFS_H_
 #define LISP_DEFS_H_
 
+#include <setjmp.h>
 #include <stdint.h>
 
 /* MY OTHER CAR IS A CDR */
@@ -30,24 +31,134 @@
 #define lisp_cdddr(l)	lisp_cdr(lisp_cdr(lisp_cdr(l)))
 
 typedef enum lisp_type_t {
-	lisp_type_integer, lisp_type_decimal, lisp_type_string, lisp_type_symbol, lisp_type_pair, lisp_type_prim, lisp_type_error
+	lisp_type_integer, lisp_type_decimal, lisp_type_string, lisp_type_symbol, lisp_type_pair, lisp_type_prim, lisp_type_error, lisp_type_boolean,
+	lisp_type_lexical, lisp_type_frame, lisp_type_global, lisp_type_closure, lisp_type_node
 } lisp_type_t;
 
 typedef struct lisp_data_t lisp_data_t;
+
+/* IMMEDIATES */
+
+/* Integers that fit into a pointer shifted by one bit and the booleans are
+ * not allocated, but encoded in the pointer itself. Fixnums have the lowest
+ * bit set, the booleans are the two other non-zero values below 8. Cells are
+ * at least 8-byte aligned, so no real pointer looks like either. The empty
+ * list remains NULL. Always use lisp_type_of() and lisp_int_value() instead
+ * of ->type and ->integer. */
+
+#define LISP_FALSE	((lisp_data_t*)(uintptr_t)2)
+#define LISP_TRUE	((lisp_data_t*)(uintptr_t)6)
+
+#define LISP_FIXNUM_MIN	(INTPTR_MIN >> 1)
+#define LISP_FIXNUM_MAX	(INTPTR_MAX >> 1)
+
+#define lisp_is_immediate(d)	(((uintptr_t)(d) & 7) != 0)
+#define lisp_is_fixnum(d)		(((uintptr_t)(d) & 1) != 0)
+#define lisp_make_fixnum(i)		((lisp_data_t*)(((uintptr_t)(intptr_t)(i) << 1) | 1))
+#define lisp_make_bool(b)		((b) ? LISP_TRUE : LISP_FALSE)
+
+#define lisp_type_of(d)		(lisp_is_fixnum(d) ? lisp_type_integer : lisp_is_immediate(d) ? lisp_type_boolean : (d)->type)
+#define lisp_int_value(d)	(lisp_is_fixnum(d) ? (int)((intptr_t)(d) >> 1) : (d)->integer)
+
+/* TEXT */
+
+/* Strings, symbols and errors keep their length in the cell. Up to
+ * LISP_INLINE_TEXT characters are stored in the cell itself, longer texts in
+ * the string heap. Use lisp_text(d) to get the characters. */
+
+#define LISP_INLINE_TEXT	14
+
+#define lisp_text(d)		((d)->length > LISP_INLINE_TEXT ? (d)->text : (d)->chars)
+#define lisp_text_length(d)	((size_t)(d)->length)
+
+/* KEYWORDS */
+
+/* Symbols the evaluator treats specially are tagged with their keyword when
+ * they are created, all others with lisp_keyword_none. */
+
+typedef enum lisp_keyword_t {
+	lisp_keyword_none, lisp_keyword_quote, lisp_keyword_set, lisp_keyword_define, lisp_keyword_if, lisp_keyword_lambda,
+	lisp_keyword_begin, lisp_keyword_cond, lisp_keyword_else, lisp_keyword_letrec, lisp_keyword_let_star, lisp_keyword_let,
+	lisp_n_keywords
+} lisp_keyword_t;
+
+#define lisp_keyword_of(d)	((lisp_type_of(d) == lisp_type_symbol) ? (lisp_keyword_t)(d)->keyword : lisp_keyword_none)
 typedef struct lisp_ctx_t lisp_ctx_t;
 
 typedef lisp_data_t* (*lisp_prim_proc)(const lisp_data_t*, lisp_ctx_t*);
 
+typedef struct lisp_cons_t {
+	struct lisp_data_t *l, *r;
+} lisp_cons_t;
+
+/* A variable reference the evaluator resolved to the slot of a frame, with
+ * depth counting the frames to skip and symbol the name it was resolved
+ * from. */
+typedef struct lisp_lexical_t {
+	unsigned int depth, slot;
+	struct lisp_data_t *symbol;
+} lisp_lexical_t;
+
+/* A reference to a global variable the evaluator resolved. Once it has been
+ * looked up, cell is the pair of the global frame holding its value, and
+ * length the stamp of the global table it was found in. */
+typedef struct lisp_global_t {
+	struct lisp_data_t *symbol;
+	struct lisp_data_t *cell;
+} lisp_global_t;
+
+/* A compound procedure. lambda is the (parameters . body) part of the lambda
+ * expression it was made from, env the environment it was made in, and
+ * length the number of parameters. */
+typedef struct lisp_closure_t {
+	struct lisp_data_t *lambda;
+	struct lisp_data_t *env;
+} lisp_closure_t;
+
+/* A node of analyzed code, with length holding its kind. What a and b hold
+ * depends on the kind. */
+typedef struct lisp_node_t {
+	struct lisp_data_t *a;
+	struct lisp_data_t *b;
+} lisp_node_t;
+
+/* FRAMES */
+
+/* The frames procedures are applied in hold the parameter list and one value
+ * slot per parameter, with length counting the slots. Up to
+ * LISP_INLINE_SLOTS values are stored in the cell itself, more in a block of
+ * the string heap. Use lisp_frame_slots(d) to get the array. */
+
+#define LISP_INLINE_SLOTS	1
+
+#define lisp_frame_slots(d)	((d)->length > LISP_INLINE_SLOTS ? (d)->frame.slots : &(d)->frame.slot)
+
+typedef struct lisp_frame_t {
+	struct lisp_data_t *vars;
+	union {
+		struct lisp_data_t **slots;
+		struct lisp_data_t *slot;
+	};
+} lisp_frame_t;
+
 struct lisp_data_t {
 	lisp_type_t type;
+	unsigned int length;
 	union {
 		int integer;
 		double decimal;
-		char *string;
-		char *symbol;
-		char *error;
+		char *text;
+		struct {
+			char chars[LISP_INLINE_TEXT + 1];
+			unsigned char keyword;
+		};
 		lisp_prim_proc proc;
-		struct lisp_cons_t *pair;
+		lisp_cons_t pair;
+		lisp_lexical_t lexical;
+		lisp_frame_t frame;
+		lisp_global_t global;
+		lisp_closure_t closure;
+		lisp_node_t node;
 	};
 };
 
@@ -65,9 +176,22 @@ typedef struct lisp_cvar_list_t {
 	struct lisp_cvar_list_t *next;
 } lisp_cvar_list_t;
 
-typedef struct lisp_cons_t {
-	struct lisp_data_t *l, *r;
-} lisp_cons_t;
+#define LISP_GC_PAUSE_BUCKETS	24
+
+typedef struct lisp_gc_info_t {
+	size_t n_collections;
+	size_t n_full_collections;
+	size_t n_pauses;
+	size_t pause_us_total;
+	size_t pause_us_max;
+	size_t pause_histogram[LISP_GC_PAUSE_BUCKETS];
+	size_t objects_marked;
+	size_t bytes_marked;
+	size_t objects_swept;
+	size_t bytes_swept;
+	size_t heap_bytes;
+	size_t heap_reserved;
+} lisp_gc_info_t;
 
 struct lisp_ctx_t {
 	lisp_data_t *the_global_environment;
@@ -85,12 +209,22 @@ struct lisp_ctx_t {
 	size_t n_allocs;
 	size_t n_frees;
 	size_t n_bytes_peak;
+	size_t n_moves;
 	size_t warned;
-	struct alloclist_t *alloc_list;
+	size_t gc_pause_budget_us;
+	size_t gc_threads;
+	size_t gc_copying;
+	size_t alloc_sample_bytes;
+	size_t eval_arena;
+	struct lisp_heap_t *heap;
+	struct lisp_globals_t *globals;
+	lisp_gc_info_t gc_info;
 
 	size_t thread_timeout;
-	int thread_running;
-	int eval_plz_die;
+	volatile int thread_running;
+	volatile int eval_plz_die;
+	jmp_buf *eval_unwind;
+	const char *eval_proc;
 };
 
 #endif
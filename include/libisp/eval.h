@@ -16,8 +16,15 @@
 
 #ifndef LISP_LIBISP_H_
 
+/* The kinds of execution nodes expressions are analyzed into. */
+typedef enum lisp_node_kind_t {
+	lisp_node_constant, lisp_node_variable, lisp_node_lexical, lisp_node_global, lisp_node_set, lisp_node_define,
+	lisp_node_if, lisp_node_lambda, lisp_node_sequence, lisp_node_application, lisp_n_node_kinds
+} lisp_node_kind_t;
+
 int is_compound_procedure(const lisp_data_t *exp);
 lisp_data_t *extend_environment(const lisp_data_t *vars, const lisp_data_t *vals, lisp_data_t *env, lisp_ctx_t *context);
+void lisp_free_globals(lisp_ctx_t *context);
 
 #endif
 
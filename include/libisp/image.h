@@ -0,0 +1,25 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include "libisp/defs.h"
+
+#ifndef LISP_IMAGE_H_
+#define LISP_IMAGE_H_
+
+#ifndef LISP_LIBISP_H_
+
+lisp_data_t *lisp_read_image(const char *path, lisp_ctx_t *context);
+
+#endif
+
+int lisp_save_image(const char *path, lisp_ctx_t *context);
+
+#endif
@@ -22,8 +22,26 @@
 #define LISP_GC_FORCE	1
 #define lisp_data_alloc(n, c) lisp_dalloc(n, __FILE__, __LINE__, c)
 
+#ifndef LISP_LIBISP_H_
+
+void lisp_write_barrier(const lisp_data_t *obj, const lisp_data_t *val);
+void lisp_free_heap(lisp_ctx_t *context);
+void lisp_gc_set_stack(const void *base, lisp_ctx_t *context);
+void lisp_arena_begin(lisp_ctx_t *context);
+lisp_data_t *lisp_arena_end(lisp_data_t *result, lisp_ctx_t *context);
+char *lisp_string_alloc(const size_t length, lisp_ctx_t *context);
+lisp_data_t **lisp_slots_alloc(const size_t n, lisp_ctx_t *context);
+void lisp_slots_free(lisp_data_t **slots, lisp_ctx_t *context);
+lisp_data_t *lisp_find_symbol(const char *name, const size_t length, lisp_ctx_t *context);
+int lisp_add_symbol(lisp_data_t *symbol, lisp_ctx_t *context);
+
+#endif
+
 lisp_data_t *lisp_dalloc(const size_t size, const char *file, const int line, lisp_ctx_t *context);
 void lisp_gc_stats(FILE *fp, lisp_ctx_t *context);
+void lisp_alloc_profile(FILE *fp, lisp_ctx_t *context);
+lisp_data_t *lisp_alloc_profile_list(lisp_ctx_t *context);
+void lisp_alloc_profile_reset(lisp_ctx_t *context);
 void lisp_free_data(lisp_data_t *in, lisp_ctx_t *context);
 void lisp_free_data_rec(lisp_data_t *in, lisp_ctx_t *context);
 size_t lisp_gc(const int force, lisp_ctx_t *context);
@@ -0,0 +1,153 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+/* Builds pairs of equal lists whose cells are scattered across the heap,
+ * collects once and then times walking the lists, first with the
+ * mark-sweep collector and then with the copying collector. Finally keeps
+ * such lists alive while evaluating code that churns through garbage with a
+ * pause budget, and fails if the collector pauses for much longer. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libisp.h"
+
+#define N_LISTS		64
+#define N_ROUNDS	10
+
+#define PAUSE_BUDGET_US	100
+#define PAUSE_CELLS	80000
+#define PAUSE_ROUNDS	400
+
+static lisp_data_t *get_lists(lisp_ctx_t *context) {
+	lisp_data_t *frame = lisp_car(context->the_global_environment);
+	return lisp_car(lisp_cdr(frame));
+}
+
+static void build_lists(const int n_cells, lisp_ctx_t *context) {
+	lisp_data_t *lists[N_LISTS], *all = NULL, *frame;
+	int i, n;
+
+	for(i = 0; i < N_LISTS; i++)
+		lists[i] = NULL;
+
+	srand(1);
+	for(n = 0; n < n_cells / 2; n++) {
+		i = (rand() % (N_LISTS / 2)) * 2;
+		lists[i] = lisp_cons(lisp_make_int(n, context), lists[i]);
+		lisp_make_decimal(n, context);
+		lists[i + 1] = lisp_cons(lisp_make_int(n, context), lists[i + 1]);
+		lisp_make_decimal(n, context);
+	}
+
+	for(i = 0; i < N_LISTS; i++)
+		all = lisp_cons(lists[i], all);
+
+	frame = lisp_car(context->the_global_environment);
+	lisp_set_car(frame, lisp_cons(lisp_make_symbol("bench-lists", context), lisp_car(frame)));
+	lisp_set_cdr(frame, lisp_cons(all, lisp_cdr(frame)));
+}
+
+static double walk_lists(lisp_ctx_t *context) {
+	lisp_data_t *list;
+	clock_t start = clock();
+	long sum = 0;
+	int round;
+
+	for(round = 0; round < N_ROUNDS; round++) {
+		for(list = get_lists(context); list; list = lisp_cdr(lisp_cdr(list))) {
+			sum += lisp_list_length(lisp_car(list));
+			sum += lisp_is_equal(lisp_car(list), lisp_car(lisp_cdr(list)));
+		}
+	}
+
+	if(sum < 0)
+		printf("%ld\n", sum);
+
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void run(const int copying, const int n_cells) {
+	lisp_ctx_t *context;
+	clock_t start;
+	double gc_time;
+
+	context = lisp_make_context(1 << 30, (size_t)1 << 34, LISP_GC_SILENT, 0, 1);
+	lisp_setup_env(context);
+	context->gc_copying = copying;
+
+	build_lists(n_cells, context);
+
+	start = clock();
+	lisp_gc(LISP_GC_FORCE, context);
+	gc_time = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	printf("%-12s gc: %.3fs, walk: %.3fs\n", copying ? "copying" : "mark-sweep", gc_time, walk_lists(context));
+
+	lisp_destroy_context(context);
+}
+
+/* The longest pause is only reported: on a busy machine any slice may be
+ * preempted, which the wall clock cannot tell apart. Pauses from the first
+ * histogram bucket at twice the budget on must stay rare though. */
+static int run_pauses(void) {
+	lisp_ctx_t *context;
+	lisp_gc_info_t info;
+	size_t i, n_over = 0, bound = 0;
+
+	context = lisp_make_context(1 << 20, (size_t)1 << 30, LISP_GC_SILENT, 0, 1);
+	lisp_setup_env(context);
+	context->gc_pause_budget_us = PAUSE_BUDGET_US;
+
+	build_lists(PAUSE_CELLS, context);
+	lisp_gc(LISP_GC_FORCE, context);
+	memset(&context->gc_info, 0, sizeof(lisp_gc_info_t));
+
+	lisp_run("(define (churn n) (if (= n 0) nil (cons (list n 'a \"b\") (churn (- n 1)))))", context);
+	for(i = 0; i < PAUSE_ROUNDS; i++) {
+		lisp_run("(churn 200)", context);
+		lisp_gc(LISP_GC_LOWMEM, context);
+	}
+
+	info = context->gc_info;
+	lisp_destroy_context(context);
+
+	for(i = 1; i < LISP_GC_PAUSE_BUCKETS; i++) {
+		if(((size_t)1 << (i - 1)) < 2 * PAUSE_BUDGET_US)
+			continue;
+		if(!bound)
+			bound = (size_t)1 << (i - 1);
+		n_over += info.pause_histogram[i];
+	}
+
+	printf("%-12s %lu pauses, max: %luus, %luus or more: %lu, full: %lu\n", "incremental",
+		(unsigned long)info.n_pauses, (unsigned long)info.pause_us_max, (unsigned long)bound,
+		(unsigned long)n_over, (unsigned long)info.n_full_collections);
+
+	return info.n_full_collections && (n_over * 100 <= info.n_pauses);
+}
+
+int main(int argc, char **argv) {
+	int n_cells = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+	printf("%d list cells in %d lists, %d rounds\n", n_cells, N_LISTS, N_ROUNDS);
+	run(0, n_cells);
+	run(1, n_cells);
+
+	if(!run_pauses()) {
+		fprintf(stderr, "ERROR: Collector pauses exceed the budget of %dus.\n", PAUSE_BUDGET_US);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
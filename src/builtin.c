@@ -18,6 +18,7 @@
 #include "libisp/builtin.h"
 #include "libisp/data.h"
 #include "libisp/eval.h"
+#include "libisp/image.h"
 #include "libisp/mem.h"
 #include "libisp/thread.h"
 
@@ -31,9 +32,9 @@ static lisp_data_t *prim_add(const lisp_data_t *list, lisp_ctx_t *context) {
 			return lisp_make_error("+ -- Expected number", context);
 		tail = lisp_cdr(list);
 
-		if(head->type == lisp_type_integer)
-			iout += head->integer;
-		else if(head->type == lisp_type_decimal)
+		if(lisp_type_of(head) == lisp_type_integer)
+			iout += lisp_int_value(head);
+		else if(lisp_type_of(head) == lisp_type_decimal)
 			dout += head->decimal;
 		else return lisp_make_error("+ -- Expected number", context);
 
@@ -58,9 +59,9 @@ static lisp_data_t *prim_mul(const lisp_data_t *list, lisp_ctx_t *context) {
 		if((head = lisp_car(list)) == NULL)
 			return lisp_make_error("* -- Expected number", context);
 		tail = lisp_cdr(list);
-		if(head->type == lisp_type_integer)
-			iout *= head->integer;
-		else if(head->type == lisp_type_decimal)
+		if(lisp_type_of(head) == lisp_type_integer)
+			iout *= lisp_int_value(head);
+		else if(lisp_type_of(head) == lisp_type_decimal)
 			dout *= head->decimal;
 		else return lisp_make_error("* -- Expected number", context);
 
@@ -88,11 +89,11 @@ static lisp_data_t *prim_sub(const lisp_data_t *list, lisp_ctx_t *context) {
 		return lisp_make_error("- -- Expected number", context);
 
 	tail = lisp_cdr(list);
-	out_type = head->type;
+	out_type = lisp_type_of(head);
 	if(out_type == lisp_type_decimal)
 		dstart = head->decimal;
 	else if(out_type == lisp_type_integer)
-		istart = head->integer;
+		istart = lisp_int_value(head);
 	else
 		return lisp_make_error("- -- Expected number", context);
 
@@ -110,9 +111,9 @@ static lisp_data_t *prim_sub(const lisp_data_t *list, lisp_ctx_t *context) {
 		if((head = lisp_car(list)) == NULL)
 			return lisp_make_error("- -- Expected number", context);
 		tail = lisp_cdr(list);
-		if(head->type == lisp_type_integer)
-			iout += head->integer;
-		else if(head->type == lisp_type_decimal) {
+		if(lisp_type_of(head) == lisp_type_integer)
+			iout += lisp_int_value(head);
+		else if(lisp_type_of(head) == lisp_type_decimal) {
 			if(out_type == lisp_type_integer) {
 				out_type = lisp_type_decimal;
 				dstart = (double)istart;
@@ -141,11 +142,11 @@ static lisp_data_t *prim_div(const lisp_data_t *list, lisp_ctx_t *context) {
 		return lisp_make_error("/ -- Expected number", context);
 
 	tail = lisp_cdr(list);
-	start_type = head->type;
+	start_type = lisp_type_of(head);
 	if(start_type == lisp_type_decimal)
 		dstart = head->decimal;
 	else if(start_type == lisp_type_integer)
-		dstart = (double)head->integer;
+		dstart = (double)lisp_int_value(head);
 	else
 		return lisp_make_error("/ -- Expected number", context);
 
@@ -159,9 +160,9 @@ static lisp_data_t *prim_div(const lisp_data_t *list, lisp_ctx_t *context) {
 			return lisp_make_error("/ -- Expected number", context);
 		tail = lisp_cdr(list);
 
-		if(head->type == lisp_type_integer)
-			dout *= head->integer;
-		else if(head->type == lisp_type_decimal)
+		if(lisp_type_of(head) == lisp_type_integer)
+			dout *= lisp_int_value(head);
+		else if(lisp_type_of(head) == lisp_type_decimal)
 			dout *= head->decimal;
 		else return 0;
 
@@ -187,13 +188,13 @@ static lisp_data_t *prim_comp_eq(const lisp_data_t *list, lisp_ctx_t *context) {
 		return lisp_make_error("= -- Expected number", context);
 	if((second = lisp_cdr(list)) == NULL)
 		return lisp_make_error("= -- Expected pair", context);
-	if(second->type != lisp_type_pair)
+	if(lisp_type_of(second) != lisp_type_pair)
 		return lisp_make_error("= -- Expected pair", context);
 	if((second = lisp_car(second)) == NULL)
 		return lisp_make_error("= -- Expected number", context);
 
-	type_first = first->type;
-	type_second = second->type;
+	type_first = lisp_type_of(first);
+	type_second = lisp_type_of(second);
 
 	if((type_first != lisp_type_decimal) && (type_first != lisp_type_integer))
 		return lisp_make_error("= -- Expected number", context);
@@ -201,14 +202,14 @@ static lisp_data_t *prim_comp_eq(const lisp_data_t *list, lisp_ctx_t *context) {
 		return lisp_make_error("= -- Expected number", context);
 
 	if(type_first == lisp_type_integer)
-		if(first->integer == second->integer)
-			return lisp_make_symbol("#t", context);
+		if(lisp_int_value(first) == lisp_int_value(second))
+			return LISP_TRUE;
 
 	if(type_first == lisp_type_decimal)
 		if(first->decimal == second->decimal)
-			return lisp_make_symbol("#t", context);
+			return LISP_TRUE;
 
-	return lisp_make_symbol("#f", context);
+	return LISP_FALSE;
 }
 
 static lisp_data_t *prim_comp_less(const lisp_data_t *list, lisp_ctx_t *context) {
@@ -221,29 +222,29 @@ static lisp_data_t *prim_comp_less(const lisp_data_t *list, lisp_ctx_t *context)
 	if((tail = lisp_car(lisp_cdr(list))) == NULL)
 		return lisp_make_error("< -- Expected number", context);
 		
-	if((head->type == lisp_type_integer) && (tail->type == lisp_type_integer)) {
-		if(head->integer < tail->integer) {
-			return lisp_make_symbol("#t", context);
+	if((lisp_type_of(head) == lisp_type_integer) && (lisp_type_of(tail) == lisp_type_integer)) {
+		if(lisp_int_value(head) < lisp_int_value(tail)) {
+			return LISP_TRUE;
 		} else {
-			return lisp_make_symbol("#f", context);
+			return LISP_FALSE;
 		}
-	} else if((head->type == lisp_type_decimal) && (tail->type == lisp_type_integer)) {
-		if(head->decimal < tail->integer) {
-			return lisp_make_symbol("#t", context);
+	} else if((lisp_type_of(head) == lisp_type_decimal) && (lisp_type_of(tail) == lisp_type_integer)) {
+		if(head->decimal < lisp_int_value(tail)) {
+			return LISP_TRUE;
 		} else {
-			return lisp_make_symbol("#f", context);
+			return LISP_FALSE;
 		}
-	} else if((head->type == lisp_type_integer) && (tail->type == lisp_type_decimal)) {
-		if(head->integer < tail->decimal) {
-			return lisp_make_symbol("#t", context);
+	} else if((lisp_type_of(head) == lisp_type_integer) && (lisp_type_of(tail) == lisp_type_decimal)) {
+		if(lisp_int_value(head) < tail->decimal) {
+			return LISP_TRUE;
 		} else {
-			return lisp_make_symbol("#f", context);
+			return LISP_FALSE;
 		}
-	} else if((head->type == lisp_type_decimal) && (tail->type == lisp_type_decimal)) {
+	} else if((lisp_type_of(head) == lisp_type_decimal) && (lisp_type_of(tail) == lisp_type_decimal)) {
 		if(head->decimal < tail->decimal) {
-			return lisp_make_symbol("#t", context);
+			return LISP_TRUE;
 		} else {
-			return lisp_make_symbol("#f", context);
+			return LISP_FALSE;
 		}
 	}
 
@@ -260,29 +261,29 @@ static lisp_data_t *prim_comp_more(const lisp_data_t *list, lisp_ctx_t *context)
 	if((tail = lisp_car(lisp_cdr(list))) == NULL)
 		return lisp_make_error("> -- Expected number", context);
 
-	if((head->type == lisp_type_integer) && (tail->type == lisp_type_integer)) {
-		if(head->integer > tail->integer) {
-			return lisp_make_symbol("#t", context);
+	if((lisp_type_of(head) == lisp_type_integer) && (lisp_type_of(tail) == lisp_type_integer)) {
+		if(lisp_int_value(head) > lisp_int_value(tail)) {
+			return LISP_TRUE;
 		} else {
-			return lisp_make_symbol("#f", context);
+			return LISP_FALSE;
 		}
-	} else if((head->type == lisp_type_decimal) && (tail->type == lisp_type_integer)) {
-		if(head->decimal > tail->integer) {
-			return lisp_make_symbol("#t", context);
+	} else if((lisp_type_of(head) == lisp_type_decimal) && (lisp_type_of(tail) == lisp_type_integer)) {
+		if(head->decimal > lisp_int_value(tail)) {
+			return LISP_TRUE;
 		} else {
-			return lisp_make_symbol("#f", context);
+			return LISP_FALSE;
 		}
-	} else if((head->type == lisp_type_integer) && (tail->type == lisp_type_decimal)) {
-		if(head->integer > tail->decimal) {
-			return lisp_make_symbol("#t", context);
+	} else if((lisp_type_of(head) == lisp_type_integer) && (lisp_type_of(tail) == lisp_type_decimal)) {
+		if(lisp_int_value(head) > tail->decimal) {
+			return LISP_TRUE;
 		} else {
-			return lisp_make_symbol("#f", context);
+			return LISP_FALSE;
 		}
-	} else if((head->type == lisp_type_decimal) && (tail->type == lisp_type_decimal)) {
+	} else if((lisp_type_of(head) == lisp_type_decimal) && (lisp_type_of(tail) == lisp_type_decimal)) {
 		if(head->decimal > tail->decimal) {
-			return lisp_make_symbol("#t", context);
+			return LISP_TRUE;
 		} else {
-			return lisp_make_symbol("#f", context);
+			return LISP_FALSE;
 		}
 	}
 
@@ -291,20 +292,20 @@ static lisp_data_t *prim_comp_more(const lisp_data_t *list, lisp_ctx_t *context)
 
 static lisp_data_t *prim_or(const lisp_data_t *list, lisp_ctx_t *context) {
 	while(list) {
-		if(lisp_is_equal(lisp_car(list), lisp_make_symbol("#t", context)))
-			return lisp_make_symbol("#t", context);
+		if(lisp_car(list) == LISP_TRUE)
+			return LISP_TRUE;
 		list = lisp_cdr(list);
 	}
-	return lisp_make_symbol("#f", context);
+	return LISP_FALSE;
 }
 
 static lisp_data_t *prim_and(const lisp_data_t *list, lisp_ctx_t *context) {
 	while(list) {
-		if(lisp_is_equal(lisp_car(list), lisp_make_symbol("#f", context)))
-			return lisp_make_symbol("#f", context);
+		if(lisp_car(list) == LISP_FALSE)
+			return LISP_FALSE;
 		list = lisp_cdr(list);
 	}
-	return lisp_make_symbol("#t", context);
+	return LISP_TRUE;
 }
 
 static lisp_data_t *prim_floor(const lisp_data_t *list, lisp_ctx_t *context) {
@@ -313,10 +314,10 @@ static lisp_data_t *prim_floor(const lisp_data_t *list, lisp_ctx_t *context) {
 	if((list = lisp_car(list)) == NULL)
 		return lisp_make_error("FLOOR -- Expected number", context);
 		
-	if(list->type == lisp_type_integer)
-		return lisp_make_int(list->integer, context);
+	if(lisp_type_of(list) == lisp_type_integer)
+		return lisp_make_int(lisp_int_value(list), context);
 
-	if(list->type == lisp_type_decimal)
+	if(lisp_type_of(list) == lisp_type_decimal)
 		return lisp_make_int((int)floor(list->decimal), context);
 
 	return lisp_make_error("FLOOR -- Expected number", context);
@@ -328,10 +329,10 @@ static lisp_data_t *prim_ceiling(const lisp_data_t *list, lisp_ctx_t *context) {
 	if((list = lisp_car(list)) == NULL)
 		return lisp_make_error("CEILING -- Expected number", context);
 
-	if(list->type == lisp_type_integer)
-		return lisp_make_int(list->integer, context);
+	if(lisp_type_of(list) == lisp_type_integer)
+		return lisp_make_int(lisp_int_value(list), context);
 
-	if(list->type == lisp_type_decimal)
+	if(lisp_type_of(list) == lisp_type_decimal)
 		return lisp_make_int((int)ceil(list->decimal), context);
 
 	return lisp_make_error("CEILING -- Invalid comparison", context);
@@ -345,10 +346,10 @@ static lisp_data_t *prim_trunc(const lisp_data_t *list, lisp_ctx_t *context) {
 	if((list = lisp_car(list)) == NULL)
 		return lisp_make_error("TRUNCATE -- Expected number", context);
 		
-	if(list->type == lisp_type_integer)
-		return lisp_make_int(list->integer, context);
+	if(lisp_type_of(list) == lisp_type_integer)
+		return lisp_make_int(lisp_int_value(list), context);
 
-	if(list->type == lisp_type_decimal) {
+	if(lisp_type_of(list) == lisp_type_decimal) {
 		num = list->decimal;
 
 		if(num < 0)
@@ -368,10 +369,10 @@ static lisp_data_t *prim_round(const lisp_data_t *list, lisp_ctx_t *context) {
 	if((list = lisp_car(list)) == NULL)
 		return lisp_make_error("ROUND -- Expected number", context);
 
-	if(list->type == lisp_type_integer)
-		return lisp_make_int(list->integer, context);
+	if(lisp_type_of(list) == lisp_type_integer)
+		return lisp_make_int(lisp_int_value(list), context);
 
-	if(list->type == lisp_type_decimal) {
+	if(lisp_type_of(list) == lisp_type_decimal) {
 		num = list->decimal;
 		fracpart = num - floor(num);
 		if(fracpart < .5)
@@ -396,14 +397,14 @@ static lisp_data_t *prim_max(const lisp_data_t *list, lisp_ctx_t *context) {
 		return lisp_make_error("MAX -- No operands", context);
 
 	while(list) {
-		if(list->type != lisp_type_pair)
+		if(lisp_type_of(list) != lisp_type_pair)
 			return lisp_make_error("MAX -- Expected pair", context);
 		val = lisp_car(list);
-		if(val->type == lisp_type_integer) {
-			ival = val->integer;
+		if(lisp_type_of(val) == lisp_type_integer) {
+			ival = lisp_int_value(val);
 			if(ival > imax)
 				imax = ival;
-		} else if(val->type == lisp_type_decimal) {
+		} else if(lisp_type_of(val) == lisp_type_decimal) {
 			dval = val->decimal;
 			if(dval > dmax)
 				dmax = dval;
@@ -426,14 +427,14 @@ static lisp_data_t *prim_min(const lisp_data_t *list, lisp_ctx_t *context) {
 		return lisp_make_error("MIN -- No operands", context);
 
 	while(list) {
-		if(list->type != lisp_type_pair)
+		if(lisp_type_of(list) != lisp_type_pair)
 			return lisp_make_error("MIN -- Expected pair", context);
 		val = lisp_car(list);
-		if(val->type == lisp_type_integer) {
-			ival = val->integer;
+		if(lisp_type_of(val) == lisp_type_integer) {
+			ival = lisp_int_value(val);
 			if(ival < imin)
 				imin = ival;
-		} else if(val->type == lisp_type_decimal) {
+		} else if(lisp_type_of(val) == lisp_type_decimal) {
 			dval = val->decimal;
 			if(dval < dmin)
 				dmin = dval;
@@ -456,8 +457,8 @@ static lisp_data_t *prim_eq(const lisp_data_t *list, lisp_ctx_t *context) {
 	second = lisp_car(lisp_cdr(list));
 	
 	if(lisp_is_equal(first, second))
-		return lisp_make_symbol("#t", context);
-	return lisp_make_symbol("#f", context);
+		return LISP_TRUE;
+	return LISP_FALSE;
 }
 
 static lisp_data_t *prim_not(const lisp_data_t *list, lisp_ctx_t *context) {
@@ -466,9 +467,9 @@ static lisp_data_t *prim_not(const lisp_data_t *list, lisp_ctx_t *context) {
 	if((list = lisp_car(list)) == NULL)
 		return lisp_make_error("NOT -- Expected boolean", context);
 	
-	if(!strcmp(list->symbol, "#f"))
-		return lisp_make_symbol("#t", context);
-	return lisp_make_symbol("#f", context);
+	if(list == LISP_FALSE)
+		return LISP_TRUE;
+	return LISP_FALSE;
 }
 
 static lisp_data_t *prim_car(const lisp_data_t *list, lisp_ctx_t *context) {
@@ -477,7 +478,7 @@ static lisp_data_t *prim_car(const lisp_data_t *list, lisp_ctx_t *context) {
 	
 	list = lisp_car(list);
 	
-	if(list && list->type == lisp_type_pair)
+	if(list && lisp_type_of(list) == lisp_type_pair)
 		return lisp_car(list);
 	return NULL;
 }
@@ -488,7 +489,7 @@ static lisp_data_t *prim_cdr(const lisp_data_t *list, lisp_ctx_t *context) {
 		
 	list = lisp_car(list);
 	
-	if(list && list->type == lisp_type_pair)
+	if(list && lisp_type_of(list) == lisp_type_pair)
 		return lisp_cdr(list);
 	return NULL;
 }
@@ -515,10 +516,10 @@ static lisp_data_t *prim_set_car(const lisp_data_t *list, lisp_ctx_t *context) {
 		return lisp_make_error("SET-CAR -- Expected pair", context);
 
 	newcar = lisp_car(lisp_cdr(list));
-	if(head->type != lisp_type_pair)
+	if(lisp_type_of(head) != lisp_type_pair)
 		return lisp_make_error("SET-CAR -- Expected pair", context);
 
-	head->pair->l = newcar;
+	lisp_set_car(head, newcar);
 
 	return head;
 }
@@ -532,10 +533,10 @@ static lisp_data_t *prim_set_cdr(const lisp_data_t *list, lisp_ctx_t *context) {
 		return lisp_make_error("SET-CDR -- Expected pair", context);
 
 	newcdr = lisp_car(lisp_cdr(list));
-	if(head->type != lisp_type_pair)
+	if(lisp_type_of(head) != lisp_type_pair)
 		return lisp_make_error("SET-CDR -- Expected pair", context);
 
-	head->pair->r = newcdr;
+	lisp_set_cdr(head, newcdr);
 
 	return head;
 }
@@ -547,10 +548,10 @@ static lisp_data_t *prim_sym_to_str(const lisp_data_t *list, lisp_ctx_t *context
 		return lisp_make_error("SYMBOL->STRING -- Expected one operand", context);
 	sym = lisp_car(list);
 
-	if(!sym || sym->type != lisp_type_symbol)
+	if(!sym || lisp_type_of(sym) != lisp_type_symbol)
 		return lisp_make_error("SYMBOL->STRING -- Expected symbol", context);
 
-	return lisp_make_string(sym->symbol, context);
+	return lisp_make_string_n(lisp_text(sym), sym->length, context);
 }
 
 static lisp_data_t *prim_str_to_sym(const lisp_data_t *list, lisp_ctx_t *context) {
@@ -560,10 +561,10 @@ static lisp_data_t *prim_str_to_sym(const lisp_data_t *list, lisp_ctx_t *context
 		return lisp_make_error("STRING->SYMBOL -- Expected one operand", context);
 	str = lisp_car(list);
 
-	if(!str || str->type != lisp_type_string)
+	if(!str || lisp_type_of(str) != lisp_type_string)
 		return lisp_make_error("STRING->SYMBOL -- Expected string", context);
 
-	return lisp_make_symbol(str->string, context);
+	return lisp_make_symbol_n(lisp_text(str), str->length, context);
 }
 
 static lisp_data_t *is_type(const lisp_data_t *list, lisp_type_t type, lisp_ctx_t *context) {
@@ -572,9 +573,9 @@ static lisp_data_t *is_type(const lisp_data_t *list, lisp_type_t type, lisp_ctx_
 		return lisp_make_error("IS-TYPE -- Expected one operand", context);
 
 	sym = lisp_car(list);
-	if(sym && (sym->type == type))
-		return lisp_make_symbol("#t", context);
-	return lisp_make_symbol("#f", context);
+	if(sym && (lisp_type_of(sym) == type))
+		return LISP_TRUE;
+	return LISP_FALSE;
 }
 
 static lisp_data_t *prim_is_sym(const lisp_data_t *list, lisp_ctx_t *context) { return is_type(list, lisp_type_symbol, context); }
@@ -593,12 +594,12 @@ static lisp_data_t *prim_is_num(const lisp_data_t *list, lisp_ctx_t *context) {
 		return lisp_make_error("IS-NUM -- Expected one operand", context);
 
 	if((head = lisp_car(list)) == NULL)
-		return lisp_make_symbol("#f", context);
+		return LISP_FALSE;
 
-	type = head->type;
+	type = lisp_type_of(head);
 	if((type == lisp_type_integer) || (type == lisp_type_decimal))
-		return lisp_make_symbol("#t", context);
-	return lisp_make_symbol("#f", context);
+		return LISP_TRUE;
+	return LISP_FALSE;
 }
 
 static lisp_data_t *prim_is_proc(const lisp_data_t *list, lisp_ctx_t *context) {
@@ -606,16 +607,12 @@ static lisp_data_t *prim_is_proc(const lisp_data_t *list, lisp_ctx_t *context) {
 		return lisp_make_error("IS-PROC -- Expected one operand", context);
 
 	list = lisp_car(list);
-	if(!list || list->type != lisp_type_pair)
-		return lisp_make_symbol("#f", context);
-	
-	list = lisp_car(list);
-	if(!list || (list->type != lisp_type_symbol))
-		return lisp_make_symbol("#f", context);
+	if(!list)
+		return LISP_FALSE;
 	
-	if((!strcmp(list->symbol, "closure")) || (!strcmp(list->symbol, "primitive")))
-		return lisp_make_symbol("#t", context);
-	return lisp_make_symbol("#f", context);
+	if((lisp_type_of(list) == lisp_type_closure) || (lisp_type_of(list) == lisp_type_prim))
+		return LISP_TRUE;
+	return LISP_FALSE;
 }
 
 static lisp_data_t *mathfn(const lisp_data_t *list, double (*func)(double), lisp_ctx_t *context) {
@@ -626,9 +623,9 @@ static lisp_data_t *mathfn(const lisp_data_t *list, double (*func)(double), lisp
 	if((val = lisp_car(list)) == NULL)
 		return lisp_make_error("MATHFN -- Expected number", context);
 
-	if(val->type == lisp_type_integer)
-		return lisp_make_decimal(func((double)val->integer), context);
-	if(val->type == lisp_type_decimal)
+	if(lisp_type_of(val) == lisp_type_integer)
+		return lisp_make_decimal(func((double)lisp_int_value(val)), context);
+	if(lisp_type_of(val) == lisp_type_decimal)
 		return lisp_make_decimal(func(val->decimal), context);
 	return lisp_make_error("MATHFN -- Expected number", context);
 }
@@ -660,16 +657,16 @@ static lisp_data_t *prim_expt(const lisp_data_t *list, lisp_ctx_t *context) {
 	if((ex = lisp_car(lisp_cdr(list))) == NULL)
 		return lisp_make_error("EXPT -- Expected number", context);
 
-	if(base->type == lisp_type_integer)
-		dbase = (double)base->integer;
-	else if(base->type == lisp_type_decimal)
+	if(lisp_type_of(base) == lisp_type_integer)
+		dbase = (double)lisp_int_value(base);
+	else if(lisp_type_of(base) == lisp_type_decimal)
 		dbase = base->decimal;
 	else
 		return lisp_make_error("EXPT -- Expected number", context);
 
-	if(ex->type == lisp_type_integer)
-		dex = (double)ex->integer;
-	else if(ex->type == lisp_type_decimal)
+	if(lisp_type_of(ex) == lisp_type_integer)
+		dex = (double)lisp_int_value(ex);
+	else if(lisp_type_of(ex) == lisp_type_decimal)
 		dex = ex->decimal;
 	else
 		return lisp_make_error("EXPT -- Expected number", context);
@@ -698,17 +695,17 @@ static lisp_data_t *cumulfn(const lisp_data_t *list, int (*func)(const int, cons
 		return lisp_make_int(0, context);
 		
 	head = lisp_car(list);
-	if(!head || (head->type != lisp_type_integer))
+	if(!head || (lisp_type_of(head) != lisp_type_integer))
 		return lisp_make_error("CUMULFN -- Expected integer", context);
-	cumul = head->integer;
+	cumul = lisp_int_value(head);
 
 	list = lisp_cdr(list);
 	while(list) {
 		head = lisp_car(list);
-		if(!head || (head->type != lisp_type_integer))
+		if(!head || (lisp_type_of(head) != lisp_type_integer))
 			return lisp_make_error("CUMULFN -- Expected integer", context);
 
-		n = head->integer;
+		n = lisp_int_value(head);
 		cumul = func(cumul, n);
 
 		list = lisp_cdr(list);
@@ -737,13 +734,13 @@ static lisp_data_t *prim_set_cvar(const lisp_data_t *list, lisp_ctx_t *context)
 	var = lisp_car(list);
 	val = lisp_car(lisp_cdr(list));
 
-	if(!var || (var->type != lisp_type_symbol))
+	if(!var || (lisp_type_of(var) != lisp_type_symbol))
 		return lisp_make_error("SET-CVAR -- Expected identifier", context);
-	var_name = var->symbol;
+	var_name = lisp_text(var);
 
-	if(!val || (val->type != lisp_type_integer))
+	if(!val || (lisp_type_of(val) != lisp_type_integer))
 		return lisp_make_error("SET-CVAR -- Expected integer", context);
-	value = val->integer;
+	value = lisp_int_value(val);
 
 	while(cvar) {
 		if(!strcmp(cvar->name, var_name)) {
@@ -768,9 +765,9 @@ static lisp_data_t *prim_get_cvar(const lisp_data_t *list, lisp_ctx_t *context)
 	if((var = lisp_car(list)) == NULL)
 		return lisp_make_error("GET-CVAR -- Expected identifier", context);
 
-	if(var->type != lisp_type_symbol)
+	if(lisp_type_of(var) != lisp_type_symbol)
 		return lisp_make_error("GET-CVAR -- Expected identifier", context);
-	var_name = var->symbol;
+	var_name = lisp_text(var);
 
 	while(cvar) {
 		if(!strcmp(cvar->name, var_name))
@@ -781,6 +778,19 @@ static lisp_data_t *prim_get_cvar(const lisp_data_t *list, lisp_ctx_t *context)
 	return lisp_make_error("GET-CVAR -- Unknown CVAR", context);
 }
 
+static lisp_data_t *prim_alloc_profile(const lisp_data_t *list, lisp_ctx_t *context) {
+	if(list)
+		return lisp_make_error("ALLOC-PROFILE -- Expected no operands", context);
+	return lisp_alloc_profile_list(context);
+}
+
+static lisp_data_t *prim_reset_alloc_profile(const lisp_data_t *list, lisp_ctx_t *context) {
+	if(list)
+		return lisp_make_error("RESET-ALLOC-PROFILE -- Expected no operands", context);
+	lisp_alloc_profile_reset(context);
+	return lisp_make_symbol("ok", context);
+}
+
 /* --- */
 
 static lisp_data_t *primitive_procedure_names(lisp_ctx_t *context) {
@@ -800,7 +810,7 @@ static lisp_data_t *primitive_procedure_objects(lisp_ctx_t *context) {
 	lisp_data_t *out = NULL;
 
 	while(curr_proc) {
-		out = lisp_cons(lisp_cons(lisp_make_symbol("primitive", context), lisp_cons(lisp_make_prim(curr_proc->proc, context), NULL)), out);
+		out = lisp_cons(lisp_make_prim(curr_proc->proc, context), out);
 		curr_proc = curr_proc->prev;
 	}
 
@@ -905,17 +915,39 @@ static void add_builtin_prim_procs(lisp_ctx_t *context) {
 
 	lisp_add_prim_proc("set-cvar!", prim_set_cvar, context);
 	lisp_add_prim_proc("get-cvar", prim_get_cvar, context);
+	lisp_add_prim_proc("alloc-profile", prim_alloc_profile, context);
+	lisp_add_prim_proc("reset-alloc-profile!", prim_reset_alloc_profile, context);
 }
 
-void lisp_setup_env(lisp_ctx_t *context) {
-	lisp_data_t *the_empty_environment = lisp_cons(lisp_cons(NULL, NULL), NULL);
-
+static void add_builtin_cvars(lisp_ctx_t *context) {
 	lisp_add_cvar("mem_lim_hard", &context->mem_lim_hard, LISP_CVAR_RO, context);
 	lisp_add_cvar("mem_lim_soft", &context->mem_lim_soft, LISP_CVAR_RO, context);
 	lisp_add_cvar("mem_list_entries", &context->mem_list_entries, LISP_CVAR_RO, context);
 	lisp_add_cvar("mem_verbosity", &context->mem_verbosity, LISP_CVAR_RW, context);
 	lisp_add_cvar("mem_allocated", &context->mem_allocated, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_copying", &context->gc_copying, LISP_CVAR_RW, context);
+	lisp_add_cvar("gc_pause_budget_us", &context->gc_pause_budget_us, LISP_CVAR_RW, context);
+	lisp_add_cvar("gc_threads", &context->gc_threads, LISP_CVAR_RO, context);
+	lisp_add_cvar("alloc_sample_bytes", &context->alloc_sample_bytes, LISP_CVAR_RW, context);
+	lisp_add_cvar("eval_arena", &context->eval_arena, LISP_CVAR_RW, context);
+	lisp_add_cvar("gc_collections", &context->gc_info.n_collections, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_full_collections", &context->gc_info.n_full_collections, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_pauses", &context->gc_info.n_pauses, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_pause_us_total", &context->gc_info.pause_us_total, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_pause_us_max", &context->gc_info.pause_us_max, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_objects_marked", &context->gc_info.objects_marked, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_bytes_marked", &context->gc_info.bytes_marked, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_objects_swept", &context->gc_info.objects_swept, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_bytes_swept", &context->gc_info.bytes_swept, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_heap_bytes", &context->gc_info.heap_bytes, LISP_CVAR_RO, context);
+	lisp_add_cvar("gc_heap_reserved", &context->gc_info.heap_reserved, LISP_CVAR_RO, context);
 	lisp_add_cvar("thread_timeout", &context->thread_timeout, LISP_CVAR_RW, context);
+}
+
+void lisp_setup_env(lisp_ctx_t *context) {
+	lisp_data_t *the_empty_environment = lisp_cons(lisp_cons(NULL, NULL), NULL);
+
+	add_builtin_cvars(context);
 
 	context->the_global_environment = 
 		extend_environment(primitive_procedure_names(context), 
@@ -980,11 +1012,28 @@ void lisp_setup_env(lisp_ctx_t *context) {
 	lisp_gc(LISP_GC_FORCE, context);
 }
 
+/* Finalizes the context like lisp_setup_env(), but takes the global
+ * environment from an image written by lisp_save_image(). The primitive
+ * procedures in the image must be registered before. Returns 0 if the image
+ * could not be loaded, in which case lisp_setup_env() can still be used. */
+int lisp_load_image(const char *path, lisp_ctx_t *context) {
+	lisp_data_t *env;
+
+	if((env = lisp_read_image(path, context)) == NULL)
+		return 0;
+
+	add_builtin_cvars(context);
+	context->the_global_environment = env;
+
+	return 1;
+}
+
 void lisp_free_context(lisp_ctx_t *context) {
 	lisp_prim_proc_list_t *current_proc = context->the_prim_procs, *procbuf;
 	lisp_cvar_list_t *current_var = context->the_cvars, *varbuf;
 
 	lisp_gc(LISP_GC_FORCE, context);
+	lisp_free_globals(context);
 	lisp_free_data_rec(context->the_global_environment, context);
 
 	while(current_proc) {
@@ -1006,7 +1055,7 @@ void lisp_free_context(lisp_ctx_t *context) {
 	context->the_last_cvar = NULL;
 }
 
-lisp_ctx_t *lisp_make_context(const size_t mem_lim_soft, const size_t mem_lim_hard, const size_t mem_verbosity, const size_t thread_timeout) {
+lisp_ctx_t *lisp_make_context(const size_t mem_lim_soft, const size_t mem_lim_hard, const size_t mem_verbosity, const size_t thread_timeout, const size_t gc_threads) {
 	lisp_ctx_t *out;
 
 	if((out = malloc(sizeof(lisp_ctx_t))) == NULL)
@@ -1016,6 +1065,7 @@ lisp_ctx_t *lisp_make_context(const size_t mem_lim_soft, const size_t mem_lim_ha
 	out->the_last_cvar = NULL;
 	out->the_prim_procs = NULL;
 	out->the_last_prim_proc = NULL;
+	out->the_global_environment = NULL;
 
 	out->mem_lim_soft = mem_lim_soft;
 	out->mem_lim_hard = mem_lim_hard;
@@ -1025,12 +1075,22 @@ lisp_ctx_t *lisp_make_context(const size_t mem_lim_soft, const size_t mem_lim_ha
 	out->n_allocs = 0;
 	out->n_frees = 0;
 	out->n_bytes_peak = 0;
+	out->n_moves = 0;
 	out->warned = 0;
-	out->alloc_list = NULL;
+	out->gc_pause_budget_us = 0;
+	out->gc_threads = gc_threads;
+	out->gc_copying = 0;
+	out->alloc_sample_bytes = 0;
+	out->eval_arena = 0;
+	out->heap = NULL;
+	out->globals = NULL;
+	memset(&out->gc_info, 0, sizeof(lisp_gc_info_t));
 
 	out->thread_timeout = thread_timeout;
 	out->thread_running = 0;
 	out->eval_plz_die = 0;
+	out->eval_unwind = NULL;
+	out->eval_proc = NULL;
 
 	add_builtin_prim_procs(out);
 
@@ -1043,6 +1103,7 @@ void lisp_destroy_context(lisp_ctx_t *context) {
 
 	lisp_free_context(context);
 	lisp_gc_stats(stderr, context);
+	lisp_free_heap(context);
 
 	free(context);
 }
\ No newline at end of file
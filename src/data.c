@@ -9,17 +9,37 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details.
  */
 
+#include <limits.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "libisp/data.h"
 #include "libisp/mem.h"
 
 /* MAKE DATA OBJECTS */
 
+static const char *keyword_names[lisp_n_keywords] = {
+	NULL, "quote", "set!", "define", "if", "lambda",
+	"begin", "cond", "else", "letrec", "let*", "let"
+};
+
+static lisp_keyword_t find_keyword(const char *ident, const size_t length) {
+	int i;
+
+	for(i = 1; i < lisp_n_keywords; i++)
+		if(!strncmp(keyword_names[i], ident, length) && !keyword_names[i][length])
+			return (lisp_keyword_t)i;
+
+	return lisp_keyword_none;
+}
+
 lisp_data_t *lisp_make_int(const int i, lisp_ctx_t *context) {
 	lisp_data_t *out;
 
+	if(((intptr_t)i >= LISP_FIXNUM_MIN) && ((intptr_t)i <= LISP_FIXNUM_MAX))
+		return lisp_make_fixnum(i);
+
 	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
 		return NULL;
 
@@ -41,36 +61,63 @@ lisp_data_t *lisp_make_decimal(const double d, lisp_ctx_t *context) {
 	return out;
 }
 
-lisp_data_t *lisp_make_string(const char *str, lisp_ctx_t *context) {
+/* The cell is allocated before the string heap block, so that an evaluation
+ * aborted by the allocator cannot leak it. Should there be no block, the
+ * collector reclaims the cell as an empty text. */
+static lisp_data_t *make_text(const lisp_type_t type, const char *text, const size_t length, lisp_ctx_t *context) {
 	lisp_data_t *out;
+	char *buf;
 
+	if(length > UINT_MAX)
+		return NULL;
 	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
 		return NULL;
 
-	if(!(out->string = malloc(strlen(str) + 1))) {
-		free(out);
-		return NULL;
+	out->type = type;
+	out->length = 0;
+	out->chars[0] = '\0';
+	out->keyword = lisp_keyword_none;
+
+	if(length > LISP_INLINE_TEXT) {
+		if(!(buf = lisp_string_alloc(length, context)))
+			return NULL;
+		out->text = buf;
+	} else {
+		buf = out->chars;
 	}
 
-	out->type = lisp_type_string;
-	strcpy(out->string, str);
+	memcpy(buf, text, length);
+	buf[length] = '\0';
+	out->length = (unsigned int)length;
 
 	return out;
 }
 
+lisp_data_t *lisp_make_string(const char *str, lisp_ctx_t *context) {
+	return make_text(lisp_type_string, str, strlen(str), context);
+}
+
+/* Takes the first length characters of str, which need not be terminated. */
+lisp_data_t *lisp_make_string_n(const char *str, const size_t length, lisp_ctx_t *context) {
+	return make_text(lisp_type_string, str, length, context);
+}
+
 lisp_data_t *lisp_make_symbol(const char *ident, lisp_ctx_t *context) {
+	return lisp_make_symbol_n(ident, strlen(ident), context);
+}
+
+/* Returns the interned symbol of that name, so symbols of the same name are
+ * always the same object and can be compared with ==. */
+lisp_data_t *lisp_make_symbol_n(const char *ident, const size_t length, lisp_ctx_t *context) {
 	lisp_data_t *out;
 
-	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
+	if((out = lisp_find_symbol(ident, length, context)) != NULL)
+		return out;
+	if((out = make_text(lisp_type_symbol, ident, length, context)) == NULL)
 		return NULL;
-
-	if(!(out->symbol = malloc(strlen(ident) + 1))) {
-		free(out);
+	if(!lisp_add_symbol(out, context))
 		return NULL;
-	}
-
-	out->type = lisp_type_symbol;
-	strcpy(out->symbol, ident);
+	out->keyword = find_keyword(ident, length);
 
 	return out;
 }
@@ -87,39 +134,113 @@ lisp_data_t *lisp_make_prim(lisp_prim_proc in, lisp_ctx_t *context) {
 	return out;
 }
 
-lisp_data_t *lisp_make_error(const char *errmsg, lisp_ctx_t *context) {
+lisp_data_t *lisp_make_lexical(const unsigned int depth, const unsigned int slot, const lisp_data_t *symbol, lisp_ctx_t *context) {
 	lisp_data_t *out;
 
 	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
 		return NULL;
 
-	if(!(out->error = malloc(strlen(errmsg) + 1))) {
-		free(out);
+	out->type = lisp_type_lexical;
+	out->lexical.depth = depth;
+	out->lexical.slot = slot;
+	out->lexical.symbol = (lisp_data_t*)symbol;
+
+	return out;
+}
+
+/* Makes a global reference to symbol that has not been looked up yet. */
+lisp_data_t *lisp_make_global(const lisp_data_t *symbol, lisp_ctx_t *context) {
+	lisp_data_t *out;
+
+	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
 		return NULL;
-	}
 
-	out->type = lisp_type_error;
-	strcpy(out->error, errmsg);
+	out->type = lisp_type_global;
+	out->length = 0;
+	out->global.symbol = (lisp_data_t*)symbol;
+	out->global.cell = NULL;
 
 	return out;
 }
 
-/* LIST MANIPULATION */
+/* Makes a compound procedure from the (parameters . body) pair of a lambda
+ * expression and the environment it is evaluated in. */
+lisp_data_t *lisp_make_closure(const lisp_data_t *lambda, const lisp_data_t *env, lisp_ctx_t *context) {
+	lisp_data_t *out;
 
-lisp_data_t *lisp_cons_in_context(const lisp_data_t *l, const lisp_data_t *r, lisp_ctx_t *context) {
+	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
+		return NULL;
+
+	out->type = lisp_type_closure;
+	out->length = (unsigned int)lisp_list_length(lisp_car(lambda));
+	out->closure.lambda = (lisp_data_t*)lambda;
+	out->closure.env = (lisp_data_t*)env;
+
+	return out;
+}
+
+/* Makes an execution node of the given kind, see analyze() in eval.c. */
+lisp_data_t *lisp_make_node(const unsigned int kind, const lisp_data_t *a, const lisp_data_t *b, lisp_ctx_t *context) {
 	lisp_data_t *out;
 
 	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
 		return NULL;
 
-	if(!(out->pair = malloc(sizeof(lisp_cons_t)))) {
-		free(out);
+	out->type = lisp_type_node;
+	out->length = kind;
+	out->node.a = (lisp_data_t*)a;
+	out->node.b = (lisp_data_t*)b;
+
+	return out;
+}
+
+lisp_data_t *lisp_make_error(const char *errmsg, lisp_ctx_t *context) {
+	return make_text(lisp_type_error, errmsg, strlen(errmsg), context);
+}
+
+/* Makes a frame binding vars to n slots, all of them NULL. Like in
+ * make_text(), the cell comes before the block of slots. */
+lisp_data_t *lisp_make_frame(const lisp_data_t *vars, const size_t n, lisp_ctx_t *context) {
+	lisp_data_t *out, **slots;
+
+	if(n > UINT_MAX)
 		return NULL;
+	if(!(out = lisp_data_alloc(sizeof(lisp_data_t), context)))
+		return NULL;
+
+	out->type = lisp_type_frame;
+	out->length = 0;
+	out->frame.vars = (lisp_data_t*)vars;
+	out->frame.slot = NULL;
+
+	if(n > LISP_INLINE_SLOTS) {
+		if(!(slots = lisp_slots_alloc(n, context)))
+			return NULL;
+		memset(slots, 0, n * sizeof(lisp_data_t*));
+		out->frame.slots = slots;
 	}
+	out->length = (unsigned int)n;
+
+	return out;
+}
+
+/* LIST MANIPULATION */
+
+lisp_data_t *lisp_cons_in_context(const lisp_data_t *l, const lisp_data_t *r, lisp_ctx_t *context) {
+	return lisp_cons_at(l, r, __FILE__, __LINE__, context);
+}
+
+/* Like lisp_cons_in_context(), but the allocation is recorded at the given
+ * call site. */
+lisp_data_t *lisp_cons_at(const lisp_data_t *l, const lisp_data_t *r, const char *file, const int line, lisp_ctx_t *context) {
+	lisp_data_t *out;
+
+	if(!(out = lisp_dalloc(sizeof(lisp_data_t), file, line, context)))
+		return NULL;
 
 	out->type = lisp_type_pair;
-	out->pair->l = (lisp_data_t*)l;
-	out->pair->r = (lisp_data_t*)r;
+	out->pair.l = (lisp_data_t*)l;
+	out->pair.r = (lisp_data_t*)r;
 
 	return out;
 }
@@ -128,20 +249,20 @@ lisp_data_t *lisp_car(const lisp_data_t *in) {
 	if(!in)
 		return NULL;
 
-	if(in->type != lisp_type_pair)
+	if(lisp_type_of(in) != lisp_type_pair)
 		return NULL;
 
-	return in->pair->l;
+	return in->pair.l;
 }
 
 lisp_data_t *lisp_cdr(const lisp_data_t *in) {
 	if(!in)
 		return NULL;
 
-	if(in->type != lisp_type_pair)
+	if(lisp_type_of(in) != lisp_type_pair)
 		return NULL;
 
-	return in->pair->r;
+	return in->pair.r;
 }
 
 int lisp_is_equal(const lisp_data_t *d1, const lisp_data_t *d2) {
@@ -153,24 +274,32 @@ int lisp_is_equal(const lisp_data_t *d1, const lisp_data_t *d2) {
 	if(!d2)
 		return 0;
 
-	if(d1->type != d2->type)
+	if(lisp_type_of(d1) != lisp_type_of(d2))
 		return 0;
 
-	switch(d1->type) {
+	switch(lisp_type_of(d1)) {
 		case lisp_type_pair:
 			return lisp_is_equal(lisp_car(d1), lisp_car(d2)) && lisp_is_equal(lisp_cdr(d1), lisp_cdr(d2));
 		case lisp_type_integer:
-			return d1->integer == d2->integer;
+			return lisp_int_value(d1) == lisp_int_value(d2);
 		case lisp_type_decimal:
 			return d1->decimal == d2->decimal;
 		case lisp_type_prim:
 			return d1->proc == d2->proc;
+		case lisp_type_lexical:
+			return (d1->lexical.depth == d2->lexical.depth) && (d1->lexical.slot == d2->lexical.slot) && (d1->lexical.symbol == d2->lexical.symbol);
+		case lisp_type_global:
+			return d1->global.symbol == d2->global.symbol;
 		case lisp_type_string:
-			return !strcmp(d1->string, d2->string);
+			return (d1->length == d2->length) && !memcmp(lisp_text(d1), lisp_text(d2), d1->length);
+		case lisp_type_symbol:
 		case lisp_type_error:
+		case lisp_type_frame:
+		case lisp_type_closure:
+		case lisp_type_node:
+			return 0;
+		case lisp_type_boolean:
 			return 0;
-		case lisp_type_symbol:			
-			return !strcmp(d1->symbol, d2->symbol);
 	}
 
 	return 0;
@@ -182,13 +311,13 @@ int lisp_list_length(const lisp_data_t *list) {
 	if(!list)
 		return 0;
 	
-	if(list->type != lisp_type_pair)
+	if(lisp_type_of(list) != lisp_type_pair)
 		return 0;
 
 	do {
 		out++;
-		if(list->type == lisp_type_pair)
-			list = list->pair->r;
+		if(lisp_type_of(list) == lisp_type_pair)
+			list = list->pair.r;
 		else
 			list = NULL;
 	} while(list);
@@ -197,88 +326,119 @@ int lisp_list_length(const lisp_data_t *list) {
 }
 
 lisp_data_t *lisp_set_car(lisp_data_t *in, const lisp_data_t *val) {
-	if(in->type != lisp_type_pair)
+	if(lisp_type_of(in) != lisp_type_pair)
 		return NULL;
-	in->pair->l = (lisp_data_t*)val;
+	lisp_write_barrier(in, val);
+	in->pair.l = (lisp_data_t*)val;
 	return (lisp_data_t*)val;
 }
 
 lisp_data_t *lisp_set_cdr(lisp_data_t *in, const lisp_data_t *val) {
-	if(in->type != lisp_type_pair)
+	if(lisp_type_of(in) != lisp_type_pair)
 		return NULL;
-	in->pair->r = (lisp_data_t*)val;
+	lisp_write_barrier(in, val);
+	in->pair.r = (lisp_data_t*)val;
 	return (lisp_data_t*)val;
 }
 
-lisp_data_t *lisp_make_copy(const lisp_data_t *in) {
-	lisp_data_t *out;
+/* FRAMES */
 
-	if(!in)
+lisp_data_t *lisp_frame_set(lisp_data_t *frame, const unsigned int slot, const lisp_data_t *val) {
+	if((lisp_type_of(frame) != lisp_type_frame) || (slot >= frame->length))
 		return NULL;
+	lisp_write_barrier(frame, val);
+	lisp_frame_slots(frame)[slot] = (lisp_data_t*)val;
+	return (lisp_data_t*)val;
+}
 
-	out = malloc(sizeof(lisp_data_t));
-	if(!out)
+/* Binds var in front of the other names of frame, moving all values up one
+ * slot. Returns NULL if there is no room for the new slot. */
+lisp_data_t *lisp_frame_add(lisp_data_t *frame, lisp_data_t *var, const lisp_data_t *val, lisp_ctx_t *context) {
+	lisp_data_t *vars, **slots, **old;
+	unsigned int n = frame->length;
+
+	if((n == UINT_MAX) || !(vars = lisp_cons(var, frame->frame.vars)))
 		return NULL;
 
-	out->type = in->type;
+	lisp_write_barrier(frame, vars);
+	lisp_write_barrier(frame, val);
+	if(n + 1 > LISP_INLINE_SLOTS) {
+		if(!(slots = lisp_slots_alloc(n + 1, context)))
+			return NULL;
+		old = lisp_frame_slots(frame);
+		memcpy(slots + 1, old, n * sizeof(lisp_data_t*));
+		slots[0] = (lisp_data_t*)val;
+		if(n > LISP_INLINE_SLOTS)
+			lisp_slots_free(old, context);
+		frame->frame.slots = slots;
+	} else {
+		frame->frame.slot = (lisp_data_t*)val;
+	}
+	frame->length = n + 1;
+	frame->frame.vars = vars;
+
+	return (lisp_data_t*)val;
+}
 
-	switch(out->type) {
-		case lisp_type_integer: out->integer = in->integer; break;
-		case lisp_type_decimal: out->decimal = in->decimal; break;
-		case lisp_type_prim: out->proc = in->proc; break;
-		case lisp_type_string: 
-			out->string = malloc(strlen(in->string) + 1);
-			strcpy(out->string, in->string);
-			break;
-		case lisp_type_symbol:
-			out->symbol = malloc(strlen(in->symbol) + 1);
-			strcpy(out->symbol, in->symbol);
-			break;
-		case lisp_type_error:
-			out->error = malloc(strlen(in->error) + 1);
-			strcpy(out->error, in->error);
-			break;
+static lisp_data_t *copy_frame(const lisp_data_t *in, lisp_ctx_t *context) {
+	lisp_data_t *out;
+	unsigned int i;
+
+	if(!(out = lisp_make_frame(lisp_make_copy(in->frame.vars, context), in->length, context)))
+		return NULL;
+	for(i = 0; i < in->length; i++)
+		lisp_frame_set(out, i, lisp_make_copy(lisp_frame_slots(in)[i], context));
+
+	return out;
+}
+
+lisp_data_t *lisp_make_copy(const lisp_data_t *in, lisp_ctx_t *context) {
+	if(!in)
+		return NULL;
+
+	switch(lisp_type_of(in)) {
+		case lisp_type_integer: return lisp_make_int(lisp_int_value(in), context);
+		case lisp_type_decimal: return lisp_make_decimal(in->decimal, context);
+		case lisp_type_prim: return lisp_make_prim(in->proc, context);
+		case lisp_type_lexical: return lisp_make_lexical(in->lexical.depth, in->lexical.slot, in->lexical.symbol, context);
+		case lisp_type_symbol: return lisp_make_symbol_n(lisp_text(in), in->length, context);
+		case lisp_type_string:
+		case lisp_type_error: return make_text(in->type, lisp_text(in), in->length, context);
 		case lisp_type_pair:
-			out->pair = malloc(sizeof(lisp_cons_t));
-			if(!out)
-				return NULL;
-			if(in->pair->l)
-				out->pair->l = lisp_make_copy(in->pair->l);
-			else
-				out->pair->l = NULL;
-
-			if(in->pair->r)
-				out->pair->r = lisp_make_copy(in->pair->r);
-			else
-				out->pair->r = NULL;
+			return lisp_cons(lisp_make_copy(in->pair.l, context), lisp_make_copy(in->pair.r, context));
+		case lisp_type_boolean: return (lisp_data_t*)in;
+		case lisp_type_frame: return copy_frame(in, context);
+		case lisp_type_global: return lisp_make_global(in->global.symbol, context);
+		case lisp_type_closure: return lisp_make_closure(lisp_make_copy(in->closure.lambda, context), in->closure.env, context);
+		case lisp_type_node: return lisp_make_node(in->length, lisp_make_copy(in->node.a, context), lisp_make_copy(in->node.b, context), context);
 	}
 
-	return out;
+	return NULL;
 }
 
-lisp_data_t *lisp_append(const lisp_data_t *list1, const lisp_data_t *list2) {
+lisp_data_t *lisp_append(const lisp_data_t *list1, const lisp_data_t *list2, lisp_ctx_t *context) {
 	lisp_data_t *out, *buf;
 
 	if(!list1) {
 		if(!list2)
 			return NULL;
-		if(list2->type != lisp_type_pair)
+		if(lisp_type_of(list2) != lisp_type_pair)
 			return NULL;
-		return lisp_make_copy(list2);
+		return lisp_make_copy(list2, context);
 	}
 
-	if(list1->type != lisp_type_pair)
+	if(lisp_type_of(list1) != lisp_type_pair)
 		return NULL;
 
 	if(!list2)
-		return lisp_make_copy(list1);
+		return lisp_make_copy(list1, context);
 
-	buf = out = lisp_make_copy(list1);
+	buf = out = lisp_make_copy(list1, context);
 
 	while(lisp_cdr(out))
 		out = lisp_cdr(out);
 	
-	lisp_set_cdr(out, lisp_make_copy(list2));
+	lisp_set_cdr(out, lisp_make_copy(list2, context));
 
 	return buf;
 }
@@ -9,53 +9,45 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details.
  */
 
-#ifdef _WIN32
-#include <Windows.h>
-#else
-#include <pthread.h>
-#define ExitThread pthread_exit
-#endif
-
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #include "libisp/builtin.h"
 #include "libisp/data.h"
+#include "libisp/eval.h"
 #include "libisp/mem.h"
 #include "libisp/print.h"
 #include "libisp/read.h"
 #include "libisp/thread.h"
 
-static lisp_data_t *eval(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *context);
+static lisp_data_t *analyze(const lisp_data_t *exp, const int top, lisp_ctx_t *context);
+static lisp_data_t *execute(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context);
 static lisp_data_t *set_variable_value(lisp_data_t *var, const lisp_data_t *val, lisp_data_t *env, lisp_ctx_t *context);
 static lisp_data_t *lookup_variable_value(const lisp_data_t *var, lisp_data_t *env, lisp_ctx_t *context);
 
 /* HELPER PROCEDURES */
 
-static int is_tagged_list(const lisp_data_t *exp, const char *tag) {
+/* Symbols are tagged with their keyword when they are made, so classifying
+ * an expression takes no string compares. */
+static lisp_keyword_t get_keyword(const lisp_data_t *exp) {
 	lisp_data_t *head;
-	if(!exp)
-		return 0;
-	if(exp->type == lisp_type_pair) {
-		head = lisp_car(exp);
-		if(!head)
-			return 0;
-		if(head->type != lisp_type_symbol)
-			return 0;
-		if(!strcmp(lisp_car(exp)->symbol , tag))
-			return 1;
-	}
-	return 0;
-}
-static int is_self_evaluating(const lisp_data_t *exp) { return (!exp || (exp->type == lisp_type_integer) || (exp->type == lisp_type_decimal) || (exp->type == lisp_type_string)); }
-static int is_symbol(const lisp_data_t *exp) { return (exp->type == lisp_type_symbol); }
+	if(!exp || (lisp_type_of(exp) != lisp_type_pair))
+		return lisp_keyword_none;
+	if((head = lisp_car(exp)) == NULL)
+		return lisp_keyword_none;
+	return lisp_keyword_of(head);
+}
+static int is_tagged_list(const lisp_data_t *exp, const lisp_keyword_t tag) { return get_keyword(exp) == tag; }
+static int is_self_evaluating(const lisp_data_t *exp) { return (!exp || lisp_is_immediate(exp) || (exp->type == lisp_type_integer) || (exp->type == lisp_type_decimal) || (exp->type == lisp_type_string)); }
+static int is_symbol(const lisp_data_t *exp) { return (lisp_type_of(exp) == lisp_type_symbol); }
 static int is_variable(const lisp_data_t *exp) { return is_symbol(exp); }
-static int is_error(const lisp_data_t *exp) { return (exp && (exp->type == lisp_type_error)); }
+static int is_error(const lisp_data_t *exp) { return (exp && (lisp_type_of(exp) == lisp_type_error)); }
 
 /* SEQUENCES */
 
-int is_begin(const lisp_data_t *exp) { return is_tagged_list(exp, "begin"); }
+int is_begin(const lisp_data_t *exp) { return is_tagged_list(exp, lisp_keyword_begin); }
 static lisp_data_t *get_begin_actions(const lisp_data_t *exp) { return lisp_cdr(exp); }
 int is_last_exp(const lisp_data_t *seq) { return lisp_cdr(seq) == NULL; }
 static lisp_data_t *get_first_exp(const lisp_data_t *seq) { return lisp_car(seq); }
@@ -71,16 +63,28 @@ static lisp_data_t *sequence_to_exp(const lisp_data_t *seq, lisp_ctx_t *context)
 int has_no_operands(const lisp_data_t *ops) { return ops == NULL; }
 static lisp_data_t *get_first_operand(const lisp_data_t *ops) { return lisp_car(ops); }
 static lisp_data_t *get_rest_operands(const lisp_data_t *ops) { return lisp_cdr(ops); }
-static lisp_data_t *eval_sequence(const lisp_data_t *exps, lisp_data_t *env, lisp_ctx_t *context) {
-	if(is_last_exp(exps))
-		return eval(get_first_exp(exps), env, context);
-	eval(get_first_exp(exps), env, context);
-	return eval_sequence(get_rest_exps(exps), env, context);
+static lisp_data_t *analyze_list(const lisp_data_t *exps, const int top, lisp_ctx_t *context) {
+	if(exps == NULL)
+		return NULL;
+	return lisp_cons(analyze(get_first_exp(exps), top, context), analyze_list(get_rest_exps(exps), top, context));
+}
+static lisp_data_t *analyze_sequence(const lisp_data_t *exps, const int top, lisp_ctx_t *context) {
+	if(exps && is_last_exp(exps))
+		return analyze(get_first_exp(exps), top, context);
+	return lisp_make_node(lisp_node_sequence, analyze_list(exps, top, context), NULL, context);
+}
+static lisp_data_t *execute_sequence(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) {
+	lisp_data_t *nodes = node->node.a;
+
+	if(nodes == NULL)
+		return NULL;
+	for(; !is_last_exp(nodes); nodes = get_rest_exps(nodes))
+		execute(get_first_exp(nodes), env, context);
+	return execute(get_first_exp(nodes), env, context);
 }
 
 /* LAMBDA */
 
-static int is_lambda(const lisp_data_t *exp) { return is_tagged_list(exp, "lambda"); }
 static lisp_data_t *get_lambda_parameters(const lisp_data_t *exp) { return lisp_cadr(exp); }
 static lisp_data_t *get_lambda_body(const lisp_data_t *exp) { return lisp_cddr(exp); }
 static lisp_data_t *make_lambda(const lisp_data_t *parameters, const lisp_data_t *body, lisp_ctx_t *context) {
@@ -89,7 +93,6 @@ static lisp_data_t *make_lambda(const lisp_data_t *parameters, const lisp_data_t
 
 /* IF */
 
-static int is_if(const lisp_data_t *exp) { return is_tagged_list(exp, "if"); }
 static lisp_data_t *get_if_predicate(const lisp_data_t *exp) { return lisp_cadr(exp); }
 static lisp_data_t *get_if_consequent(const lisp_data_t *exp) { return lisp_caddr(exp); }
 static lisp_data_t *get_if_alternative(const lisp_data_t *exp) {
@@ -100,26 +103,32 @@ static lisp_data_t *get_if_alternative(const lisp_data_t *exp) {
 static lisp_data_t *make_if(const lisp_data_t *pred, const lisp_data_t *conseq, const lisp_data_t *alt, lisp_ctx_t *context) {
 	return lisp_cons(lisp_make_symbol("if", context), lisp_cons(pred, lisp_cons(conseq, lisp_cons(alt, NULL))));
 }
-static int is_true(const lisp_data_t *x) { return !strcmp(x->symbol, "#t"); }
-static int is_false(const lisp_data_t *x) { return strcmp(x->symbol, "#t"); }
-static lisp_data_t *eval_if(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *context) {
-	if(is_true(eval(get_if_predicate(exp), env, context)))
-		return eval(get_if_consequent(exp), env, context);
-	return eval(get_if_alternative(exp), env, context);
+static int is_true(const lisp_data_t *x) { return x == LISP_TRUE; }
+static int is_false(const lisp_data_t *x) { return x != LISP_TRUE; }
+static lisp_data_t *analyze_if(const lisp_data_t *exp, const int top, lisp_ctx_t *context) {
+	lisp_data_t *branches = lisp_cons(analyze(get_if_consequent(exp), top, context), analyze(get_if_alternative(exp), top, context));
+	return lisp_make_node(lisp_node_if, analyze(get_if_predicate(exp), top, context), branches, context);
+}
+static lisp_data_t *execute_if(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) {
+	if(is_true(execute(node->node.a, env, context)))
+		return execute(lisp_car(node->node.b), env, context);
+	return execute(lisp_cdr(node->node.b), env, context);
 }
 
 /* COND */
 
-static int is_cond(const lisp_data_t *exp) { return is_tagged_list(exp, "cond"); }
 static lisp_data_t *get_cond_clauses(const lisp_data_t *exp) { return lisp_cdr(exp); }
 static lisp_data_t *get_cond_predicate(const lisp_data_t *clause) { return lisp_car(clause); }
-static int is_cond_else_clause(const lisp_data_t *clause, lisp_ctx_t *context) { return lisp_is_equal(get_cond_predicate(clause), lisp_make_symbol("else", context)); }
+static int is_cond_else_clause(const lisp_data_t *clause, lisp_ctx_t *context) {
+	lisp_data_t *pred = get_cond_predicate(clause);
+	return pred && (lisp_keyword_of(pred) == lisp_keyword_else);
+}
 static lisp_data_t *get_cond_actions(const lisp_data_t *clause) { return lisp_cdr(clause); }
 static lisp_data_t *expand_clauses(const lisp_data_t *clauses, lisp_ctx_t *context) {
 	lisp_data_t *first, *rest;
 
 	if(clauses == NULL)
-		return lisp_make_symbol("#f", context);
+		return LISP_FALSE;
 
 	first = lisp_car(clauses);
 	rest = lisp_cdr(clauses);
@@ -138,32 +147,177 @@ static lisp_data_t *cond_to_if(const lisp_data_t *exp, lisp_ctx_t *context) {
 
 /* APPLICATIONS */
 
-int is_application(const lisp_data_t *exp) { return exp->type == lisp_type_pair; }
+int is_application(const lisp_data_t *exp) { return lisp_type_of(exp) == lisp_type_pair; }
 static lisp_data_t *get_operator(const lisp_data_t *exp) { return lisp_car(exp); }
 static lisp_data_t *get_operands(const lisp_data_t *exp) { return lisp_cdr(exp); }
-static lisp_data_t *get_list_of_values(const lisp_data_t *exps, lisp_data_t *env, lisp_ctx_t *context) {
-	if(has_no_operands(exps))
+static lisp_data_t *get_list_of_values(const lisp_data_t *nodes, lisp_data_t *env, lisp_ctx_t *context) {
+	if(has_no_operands(nodes))
 		return NULL;
-	return lisp_cons(eval(get_first_operand(exps), env, context), get_list_of_values(get_rest_operands(exps), env, context));
+	return lisp_cons(execute(get_first_operand(nodes), env, context), get_list_of_values(get_rest_operands(nodes), env, context));
+}
+static lisp_data_t *analyze_application(const lisp_data_t *exp, const int top, lisp_ctx_t *context) {
+	return lisp_make_node(lisp_node_application, analyze(get_operator(exp), top, context), analyze_list(get_operands(exp), top, context), context);
 }
 
 /* PROCEDURES */
 
-int is_compound_procedure(const lisp_data_t *exp) { return is_tagged_list(exp, "closure"); }
-static int is_primitive_procedure(const lisp_data_t *proc) { return is_tagged_list(proc, "primitive"); }
-static lisp_data_t *get_primitive_implementation(const lisp_data_t *proc) { return lisp_cadr(proc); }
-static lisp_data_t *get_procedure_body(const lisp_data_t *proc) { return lisp_caddr(proc); }
-static lisp_data_t *get_procedure_parameters(const lisp_data_t *proc) { return lisp_cadr(proc); }
-static lisp_data_t *get_procedure_environment(const lisp_data_t *proc) { return lisp_car(lisp_cdddr(proc)); }
-static lisp_data_t *make_procedure(lisp_data_t *parameters, lisp_data_t *body, lisp_data_t *env, lisp_ctx_t *context) {
-	return lisp_cons(lisp_make_symbol("closure", context), lisp_cons(parameters, lisp_cons(body, lisp_cons(env, NULL))));
-}
-static lisp_data_t *apply_primitive_procedure(const lisp_data_t *proc, const lisp_data_t *args, lisp_ctx_t *context) { return get_primitive_implementation(proc)->proc(args, context); }
+int is_compound_procedure(const lisp_data_t *exp) { return exp && (lisp_type_of(exp) == lisp_type_closure); }
+static lisp_data_t *get_procedure_body(const lisp_data_t *proc) { return lisp_cdr(proc->closure.lambda); }
+static lisp_data_t *get_procedure_parameters(const lisp_data_t *proc) { return lisp_car(proc->closure.lambda); }
+static lisp_data_t *get_procedure_environment(const lisp_data_t *proc) { return proc->closure.env; }
+static unsigned int get_procedure_arity(const lisp_data_t *proc) { return proc->length; }
+static lisp_data_t *make_procedure(const lisp_data_t *lambda, lisp_data_t *env, lisp_ctx_t *context) { return lisp_make_closure(lambda, env, context); }
+static lisp_data_t *apply_primitive_procedure(const lisp_data_t *proc, const lisp_data_t *args, lisp_ctx_t *context) { return proc->proc(args, context); }
 
 /* QUOTATIONS */
 
-static int is_quoted_expression(const lisp_data_t *exp) { return is_tagged_list(exp, "quote"); }
 static lisp_data_t *get_text_of_quotation(const lisp_data_t *exp) { return lisp_cadr(exp); }
+static lisp_data_t *execute_constant(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) { return node->node.a; }
+
+/* GLOBAL FRAME */
+
+/* The global frame keeps its pair of lists, so the collector, images and
+ * embedders see it as before. Next to it an open-addressing table maps
+ * each interned symbol to the cell of the value list holding its global
+ * value. The table is rebuilt from the lists when the collector has moved
+ * objects or the frame was changed behind the evaluator's back. define and
+ * set! update these cells in place, so the global references in resolved
+ * code keep the cell they found until the next rebuild. */
+
+#define MIN_GLOBALS	256
+
+struct lisp_globals_t {
+	const lisp_data_t *env;
+	const lisp_data_t *vars;
+	size_t n_moves;
+	unsigned int stamp;
+	size_t size;
+	size_t n;
+	const lisp_data_t **keys;
+	lisp_data_t **cells;
+};
+
+static size_t find_global_slot(const struct lisp_globals_t *table, const lisp_data_t *var) {
+	size_t i = (size_t)(((uintptr_t)var >> 3) * 2654435761u) & (table->size - 1);
+
+	while(table->keys[i] && table->keys[i] != var)
+		i = (i + 1) & (table->size - 1);
+	return i;
+}
+static int grow_globals(struct lisp_globals_t *table) {
+	struct lisp_globals_t grown = *table;
+	const lisp_data_t **keys = table->keys;
+	lisp_data_t **cells = table->cells;
+	size_t i, slot;
+
+	grown.size = table->size ? 2 * table->size : MIN_GLOBALS;
+	if((grown.keys = calloc(grown.size, sizeof(lisp_data_t*))) == NULL)
+		return 0;
+	if((grown.cells = malloc(grown.size * sizeof(lisp_data_t*))) == NULL) {
+		free(grown.keys);
+		return 0;
+	}
+
+	for(i = 0; i < table->size; i++) {
+		if(keys[i]) {
+			slot = find_global_slot(&grown, keys[i]);
+			grown.cells[slot] = cells[i];
+			grown.keys[slot] = keys[i];
+		}
+	}
+
+	*table = grown;
+	free(keys);
+	free(cells);
+	return 1;
+}
+/* The first binding of a symbol in the frame shadows later ones. */
+static int index_global(struct lisp_globals_t *table, const lisp_data_t *var, lisp_data_t *cell) {
+	size_t slot;
+
+	if(2 * (table->n + 1) > table->size && !grow_globals(table))
+		return 0;
+
+	slot = find_global_slot(table, var);
+	if(table->keys[slot])
+		return 1;
+	table->cells[slot] = cell;
+	table->keys[slot] = var;
+	table->n++;
+	return 1;
+}
+static int rebuild_globals(struct lisp_globals_t *table, lisp_ctx_t *context) {
+	lisp_data_t *frame = lisp_car(context->the_global_environment), *vars, *vals;
+
+	table->env = NULL;
+	table->n = 0;
+	if(table->size == 0 && !grow_globals(table))
+		return 0;
+	memset(table->keys, 0, table->size * sizeof(lisp_data_t*));
+
+	for(vars = lisp_car(frame), vals = lisp_cdr(frame); vars && vals; vars = lisp_cdr(vars), vals = lisp_cdr(vals))
+		if(lisp_car(vars) && !index_global(table, lisp_car(vars), vals))
+			return 0;
+
+	table->vars = lisp_car(frame);
+	table->n_moves = context->n_moves;
+	table->env = context->the_global_environment;
+	if(++table->stamp == 0)
+		table->stamp = 1;
+	return 1;
+}
+static struct lisp_globals_t *get_globals(lisp_ctx_t *context) {
+	struct lisp_globals_t *table = context->globals;
+
+	if(table == NULL) {
+		if((table = calloc(1, sizeof(struct lisp_globals_t))) == NULL)
+			return NULL;
+		context->globals = table;
+	}
+
+	if(table->env == context->the_global_environment && table->n_moves == context->n_moves && table->vars == lisp_car(lisp_car(table->env)))
+		return table;
+	return rebuild_globals(table, context) ? table : NULL;
+}
+/* Returns the value cell of var or NULL if it is unbound. */
+static lisp_data_t *find_global(const struct lisp_globals_t *table, const lisp_data_t *var) {
+	size_t slot = find_global_slot(table, var);
+	return table->keys[slot] ? table->cells[slot] : NULL;
+}
+static void note_global(const lisp_data_t *var, lisp_data_t *frame, lisp_ctx_t *context) {
+	struct lisp_globals_t *table = context->globals;
+
+	if(table->env == context->the_global_environment && table->n_moves == context->n_moves && index_global(table, var, lisp_cdr(frame)))
+		table->vars = lisp_car(frame);
+	else
+		table->env = NULL;
+}
+static lisp_data_t *lookup_global(lisp_data_t *ref, lisp_ctx_t *context) {
+	struct lisp_globals_t *table;
+	lisp_data_t *cell;
+
+	if((table = get_globals(context)) == NULL)
+		return lookup_variable_value(ref->global.symbol, context->the_global_environment, context);
+
+	if(ref->length != table->stamp) {
+		if((cell = find_global(table, ref->global.symbol)) == NULL)
+			return lisp_make_error("LOOKUP -- Unbound variable", context);
+		lisp_write_barrier(ref, cell);
+		ref->global.cell = cell;
+		ref->length = table->stamp;
+	}
+	return lisp_car(ref->global.cell);
+}
+static lisp_data_t *execute_global(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) { return lookup_global(node->node.a, context); }
+void lisp_free_globals(lisp_ctx_t *context) {
+	if(context->globals == NULL)
+		return;
+
+	free(context->globals->keys);
+	free(context->globals->cells);
+	free(context->globals);
+	context->globals = NULL;
+}
 
 /* VARIABLE LOOKUP */
 
@@ -171,52 +325,90 @@ static lisp_data_t *get_enclosing_env(lisp_data_t *env) { return lisp_cdr(env);
 static lisp_data_t *get_first_frame(lisp_data_t *env) { return lisp_car(env); }
 static lisp_data_t *get_frame_variables(lisp_data_t *frame) { return lisp_car(frame); }
 static lisp_data_t *get_frame_values(lisp_data_t *frame) { return lisp_cdr(frame); }
+/* Frames of applications keep their values in slots, only the global frame
+ * and frames made by extend_environment() are pairs of lists. */
+static int has_slots(const lisp_data_t *frame) { return frame && (lisp_type_of(frame) == lisp_type_frame); }
+static int find_frame_slot(const lisp_data_t *frame, const lisp_data_t *var) {
+	const lisp_data_t *vars;
+	int i;
+
+	for(i = 0, vars = frame->frame.vars; vars; i++, vars = lisp_cdr(vars))
+		if(lisp_car(vars) == var)
+			return i;
+	return -1;
+}
 static lisp_data_t *scan_lookup(lisp_data_t *env, const lisp_data_t *vars, const lisp_data_t *vals, const lisp_data_t *var, lisp_ctx_t *context) {
 	if(vars == NULL)
 		return lookup_variable_value(var, get_enclosing_env(env), context);
-	if(lisp_is_equal(var, lisp_car(vars)))
+	if(var == lisp_car(vars))
 		return lisp_car(vals);
 	return scan_lookup(env, lisp_cdr(vars), lisp_cdr(vals), var, context);
 }
 static lisp_data_t *lookup_variable_value(const lisp_data_t *var, lisp_data_t *env, lisp_ctx_t *context) {
-	lisp_data_t *current_frame;
+	struct lisp_globals_t *table;
+	lisp_data_t *current_frame, *cell;
+	int slot;
 
 	if(env == NULL)
 		return lisp_make_error("LOOKUP -- Unbound variable", context);
+	if(env == context->the_global_environment && (table = get_globals(context)) != NULL) {
+		if((cell = find_global(table, var)) == NULL)
+			return lisp_make_error("LOOKUP -- Unbound variable", context);
+		return lisp_car(cell);
+	}
 		
 	current_frame = get_first_frame(env);
+	if(has_slots(current_frame)) {
+		if((slot = find_frame_slot(current_frame, var)) < 0)
+			return lookup_variable_value(var, get_enclosing_env(env), context);
+		return lisp_frame_slots(current_frame)[slot];
+	}
 	return scan_lookup(env, get_frame_variables(current_frame), get_frame_values(current_frame), var, context);
 }
+static lisp_data_t *execute_variable(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) { return lookup_variable_value(node->node.a, env, context); }
 
 /* ASSIGNMENT */
 
-static int is_assignment(const lisp_data_t *exp) { return is_tagged_list(exp, "set!"); }
 static lisp_data_t *get_assignment_variable(const lisp_data_t *exp) { return lisp_cadr(exp); }
 static lisp_data_t *get_assignment_value(const lisp_data_t *exp) { return lisp_caddr(exp); }
 static lisp_data_t *scan_assignment(lisp_data_t *env, const lisp_data_t *vars, lisp_data_t *vals, lisp_data_t *var, const lisp_data_t *val, lisp_ctx_t *context) {
 	if(vars == NULL)
 		return set_variable_value(var, val, get_enclosing_env(env), context);
-	if(lisp_is_equal(var, lisp_car(vars)))
+	if(var == lisp_car(vars))
 		return lisp_set_car(vals, val);
 	return scan_assignment(env, lisp_cdr(vars), lisp_cdr(vals), var, val, context);
 }
 static lisp_data_t *set_variable_value(lisp_data_t *var, const lisp_data_t *val, lisp_data_t *env, lisp_ctx_t *context) {
-	lisp_data_t *current_frame;
+	struct lisp_globals_t *table;
+	lisp_data_t *current_frame, *cell;
+	int slot;
 
 	if(env == NULL)
 		return lisp_make_error("SET -- Unbound variable", context);
+	if(env == context->the_global_environment && (table = get_globals(context)) != NULL) {
+		if((cell = find_global(table, var)) == NULL)
+			return lisp_make_error("SET -- Unbound variable", context);
+		return lisp_set_car(cell, val);
+	}
 		
 	current_frame = get_first_frame(env);
+	if(has_slots(current_frame)) {
+		if((slot = find_frame_slot(current_frame, var)) < 0)
+			return set_variable_value(var, val, get_enclosing_env(env), context);
+		return lisp_frame_set(current_frame, (unsigned int)slot, val);
+	}
 	return scan_assignment(env, get_frame_variables(current_frame), get_frame_values(current_frame), var, val, context);
 }
 static lisp_data_t *make_frame(const lisp_data_t *vars, const lisp_data_t *vals, lisp_ctx_t *context) { return lisp_cons(vars, vals); }
-static lisp_data_t *eval_assignment(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *context) {
-	return set_variable_value(get_assignment_variable(exp), eval(get_assignment_value(exp), env, context), env, context);
+static lisp_data_t *analyze_assignment(const lisp_data_t *exp, const int top, lisp_ctx_t *context) {
+	return lisp_make_node(lisp_node_set, get_assignment_variable(exp), analyze(get_assignment_value(exp), top, context), context);
+}
+static lisp_data_t *execute_assignment(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) {
+	return set_variable_value(node->node.a, execute(node->node.b, env, context), env, context);
 }
 
 /* DEFINITION */
 
-static int is_definition(const lisp_data_t *exp) { return is_tagged_list(exp, "define"); }
 static lisp_data_t *get_definition_variable(const lisp_data_t *exp) {
 	if(is_symbol(lisp_cadr(exp)))
 		return lisp_cadr(exp);
@@ -227,22 +419,49 @@ static lisp_data_t *get_definition_value(const lisp_data_t *exp, lisp_ctx_t *con
 		return lisp_caddr(exp);
 	return make_lambda(lisp_cdadr(exp), lisp_cddr(exp), context);
 }
+/* The allocator may unwind out of either cons, so the frame is only changed
+ * once both exist. Otherwise its names and values would fall out of step. */
 static lisp_data_t *add_binding_to_frame(lisp_data_t *var, const lisp_data_t *val, lisp_data_t *frame, lisp_ctx_t *context) {
-	lisp_set_car(frame, (lisp_cons(var, lisp_car(frame))));
-	lisp_set_cdr(frame, (lisp_cons(val, lisp_cdr(frame))));
+	lisp_data_t *vals, *vars;
+
+	if(!(vals = lisp_cons(val, lisp_cdr(frame))) || !(vars = lisp_cons(var, lisp_car(frame))))
+		return lisp_make_error("DEFINE -- Could not allocate binding", context);
+
+	lisp_set_car(frame, vars);
+	lisp_set_cdr(frame, vals);
 	return (lisp_data_t*)val;
 }
 static lisp_data_t *scan_define(lisp_data_t *vars, lisp_data_t *vals, lisp_data_t *var, const lisp_data_t *val, lisp_data_t *frame, lisp_ctx_t *context) {
 	if(vars == NULL) {
 		return add_binding_to_frame(var, val, frame, context);
-	} if(lisp_is_equal(var, lisp_car(vars))) {
+	} if(var == lisp_car(vars)) {
 		lisp_set_car(vals, val);
 		return (lisp_data_t*)val;
 	}
 	return scan_define(lisp_cdr(vars), lisp_cdr(vals), var, val, frame, context);
 }
 static lisp_data_t *define_variable(lisp_data_t *var, const lisp_data_t *val, lisp_data_t *env, lisp_ctx_t *context) {
-	lisp_data_t *frame = get_first_frame(env);
+	lisp_data_t *frame = get_first_frame(env), *cell;
+	struct lisp_globals_t *table;
+	int slot;
+
+	if(has_slots(frame)) {
+		if((slot = find_frame_slot(frame, var)) < 0)
+			return lisp_frame_add(frame, var, val, context);
+		return lisp_frame_set(frame, (unsigned int)slot, val);
+	}
+
+	if(env == context->the_global_environment && (table = get_globals(context)) != NULL) {
+		if((cell = find_global(table, var)) != NULL) {
+			lisp_set_car(cell, val);
+			return (lisp_data_t*)val;
+		}
+		if((cell = add_binding_to_frame(var, val, frame, context)) != val)
+			return cell;
+		note_global(var, frame, context);
+		return (lisp_data_t*)val;
+	}
+
 	return scan_define(
 		get_frame_variables(frame), 
 		get_frame_values(frame), 
@@ -251,13 +470,15 @@ static lisp_data_t *define_variable(lisp_data_t *var, const lisp_data_t *val, li
 		frame, 
 		context);
 }
-static lisp_data_t *eval_definition(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *context) {	
-	return define_variable(get_definition_variable(exp), eval(get_definition_value(exp, context), env, context), env, context);
+static lisp_data_t *analyze_definition(const lisp_data_t *exp, const int top, lisp_ctx_t *context) {
+	return lisp_make_node(lisp_node_define, get_definition_variable(exp), analyze(get_definition_value(exp, context), top, context), context);
+}
+static lisp_data_t *execute_definition(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) {
+	return define_variable(node->node.a, execute(node->node.b, env, context), env, context);
 }
 
 /* LET */
 
-static int is_let(const lisp_data_t *exp) { return is_tagged_list(exp, "let"); }
 static lisp_data_t *get_let_assignment(const lisp_data_t *exp) { return lisp_cadr(exp); }
 static lisp_data_t *get_let_body(const lisp_data_t *exp) { return lisp_cddr(exp); }
 static lisp_data_t *get_let_exp(const lisp_data_t *assignment, lisp_ctx_t *context) {
@@ -279,7 +500,6 @@ static lisp_data_t *let_to_combination(const lisp_data_t *exp, lisp_ctx_t *conte
 
 /* LET* */
 
-static int is_let_star(const lisp_data_t *exp) { return is_tagged_list(exp, "let*"); }
 static lisp_data_t *get_let_star_assignment(const lisp_data_t *exp) { return lisp_cadr(exp); }
 static lisp_data_t *get_let_star_body(const lisp_data_t *exp) { return lisp_cddr(exp); }
 static lisp_data_t *transform_let_star(const lisp_data_t *assignment, const lisp_data_t *body, lisp_ctx_t *context) {
@@ -295,7 +515,6 @@ static lisp_data_t *let_star_to_nested_lets(const lisp_data_t *exp, lisp_ctx_t *
 
 /* LETREC */
 
-static int is_letrec(const lisp_data_t *exp) { return is_tagged_list(exp, "letrec"); }
 static lisp_data_t *make_unassigned_letrec(const lisp_data_t *vars, lisp_ctx_t *context) {
 	if(vars == NULL)
 		return NULL;
@@ -310,7 +529,232 @@ static lisp_data_t *letrec_to_let(const lisp_data_t *exp, lisp_ctx_t *context) {
 	lisp_data_t *assignment = get_let_assignment(exp);
 	lisp_data_t *lvars = get_let_var(assignment, context);
 	lisp_data_t *lexps = get_let_exp(assignment, context);
-	return lisp_cons(lisp_make_symbol("let", context), lisp_cons(make_unassigned_letrec(lvars, context), lisp_append(make_set_letrec(lvars, lexps, context), get_let_body(exp))));
+	return lisp_cons(lisp_make_symbol("let", context), lisp_cons(make_unassigned_letrec(lvars, context), lisp_append(make_set_letrec(lvars, lexps, context), get_let_body(exp), context)));
+}
+
+/* LEXICAL ADDRESSING */
+
+/* When a lambda outside of all others is analyzed, the scopes of the
+ * lambdas, lets and letrecs in its body are worked out once and references
+ * to their parameters are replaced by the frame depth and slot, so looking
+ * them up needs no compares. References to names no scope binds become
+ * global references. Lambdas further in are covered by this pass.
+ * Internal definitions add to the front of a frame and move its slots, so
+ * names bound in a frame with definitions are still looked up by name, just
+ * like globals. */
+
+typedef struct scope_t {
+	const lisp_data_t *vars;
+	size_t n_vars;
+	int bindings;
+	const lisp_data_t **defined;
+	size_t n_defined;
+	size_t size_defined;
+	int opaque;
+	const struct scope_t *outer;
+} scope_t;
+
+static void resolve_exp(lisp_data_t *exp, const scope_t *scope, lisp_ctx_t *context);
+
+static void open_scope(scope_t *scope, const lisp_data_t *vars, const size_t n_vars, const int bindings, const scope_t *outer) {
+	scope->vars = vars;
+	scope->n_vars = n_vars;
+	scope->bindings = bindings;
+	scope->defined = NULL;
+	scope->n_defined = 0;
+	scope->size_defined = 0;
+	scope->opaque = 0;
+	scope->outer = outer;
+}
+static void add_definition(scope_t *scope, const lisp_data_t *var) {
+	const lisp_data_t **grown;
+	size_t size;
+
+	if(scope->n_defined == scope->size_defined) {
+		size = scope->size_defined ? 2 * scope->size_defined : 8;
+		if((grown = realloc(scope->defined, size * sizeof(lisp_data_t*))) == NULL) {
+			scope->opaque = 1;
+			return;
+		}
+		scope->defined = grown;
+		scope->size_defined = size;
+	}
+	scope->defined[scope->n_defined++] = var;
+}
+/* Records the names exp defines in the frame of scope, without looking into
+ * expressions that are evaluated in frames of their own. */
+static void collect_definitions(const lisp_data_t *exp, scope_t *scope) {
+	const lisp_data_t *rest;
+
+	if(!exp || (lisp_type_of(exp) != lisp_type_pair))
+		return;
+
+	switch(get_keyword(exp)) {
+		case lisp_keyword_quote:
+		case lisp_keyword_lambda:
+		case lisp_keyword_letrec:
+			return;
+		case lisp_keyword_define:
+			add_definition(scope, get_definition_variable(exp));
+			if(is_symbol(lisp_cadr(exp)))
+				collect_definitions(lisp_caddr(exp), scope);
+			return;
+		case lisp_keyword_let:
+			for(rest = get_let_assignment(exp); rest; rest = lisp_cdr(rest))
+				collect_definitions(lisp_cadar(rest), scope);
+			return;
+		case lisp_keyword_let_star:
+			collect_definitions(lisp_cadar(get_let_star_assignment(exp)), scope);
+			return;
+		case lisp_keyword_cond:
+			for(rest = get_cond_clauses(exp); rest; rest = lisp_cdr(rest))
+				collect_definitions(lisp_car(rest), scope);
+			return;
+		default:
+			for(rest = exp; rest; rest = lisp_cdr(rest))
+				collect_definitions(lisp_car(rest), scope);
+	}
+}
+static int is_defined_in(const scope_t *scope, const lisp_data_t *var) {
+	size_t i;
+
+	if(scope->opaque)
+		return 1;
+	for(i = 0; i < scope->n_defined; i++)
+		if(scope->defined[i] == var)
+			return 1;
+	return 0;
+}
+static int find_slot(const scope_t *scope, const lisp_data_t *var) {
+	const lisp_data_t *vars = scope->vars;
+	size_t i;
+
+	for(i = 0; vars && (i < scope->n_vars); i++, vars = lisp_cdr(vars))
+		if((scope->bindings ? lisp_caar(vars) : lisp_car(vars)) == var)
+			return (int)i;
+	return -1;
+}
+/* Returns the lexical address of var, a global reference if no scope binds
+ * it, or NULL if it has to be looked up by name. */
+static lisp_data_t *resolve_variable(const lisp_data_t *var, const scope_t *scope, lisp_ctx_t *context) {
+	unsigned int depth;
+	int slot;
+
+	for(depth = 0; scope; scope = scope->outer, depth++) {
+		if(is_defined_in(scope, var))
+			return NULL;
+		if((slot = find_slot(scope, var)) >= 0)
+			return scope->n_defined ? NULL : lisp_make_lexical(depth, (unsigned int)slot, var, context);
+	}
+	return lisp_make_global(var, context);
+}
+static void resolve_list(lisp_data_t *exps, const scope_t *scope, lisp_ctx_t *context) {
+	lisp_data_t *exp, *address;
+
+	for(; exps; exps = lisp_cdr(exps)) {
+		exp = lisp_car(exps);
+		if(exp && is_symbol(exp) && (lisp_keyword_of(exp) == lisp_keyword_none)) {
+			if((address = resolve_variable(exp, scope, context)) != NULL)
+				lisp_set_car(exps, address);
+		} else {
+			resolve_exp(exp, scope, context);
+		}
+	}
+}
+/* Resolves a body evaluated in a new frame binding vars. For letrec, inits
+ * are the bindings, whose expressions are evaluated in that frame as well. */
+static void resolve_body(const lisp_data_t *vars, const int bindings, lisp_data_t *inits, lisp_data_t *body, const scope_t *outer, lisp_ctx_t *context) {
+	lisp_data_t *rest;
+	scope_t scope;
+
+	open_scope(&scope, vars, (size_t)-1, bindings, outer);
+	for(rest = inits; rest; rest = lisp_cdr(rest))
+		collect_definitions(lisp_cadar(rest), &scope);
+	for(rest = body; rest; rest = lisp_cdr(rest))
+		collect_definitions(lisp_car(rest), &scope);
+
+	for(rest = inits; rest; rest = lisp_cdr(rest))
+		resolve_list(lisp_cdar(rest), &scope, context);
+	resolve_list(body, &scope, context);
+	free(scope.defined);
+}
+/* let* becomes one let per binding, see transform_let_star(). */
+static void resolve_let_star(lisp_data_t *assignment, lisp_data_t *body, const scope_t *outer, lisp_ctx_t *context) {
+	lisp_data_t *rest = lisp_cdr(assignment);
+	scope_t scope;
+
+	resolve_list(lisp_cdar(assignment), outer, context);
+	if(rest == NULL) {
+		resolve_body(assignment, 1, NULL, body, outer, context);
+		return;
+	}
+
+	open_scope(&scope, assignment, 1, 1, outer);
+	collect_definitions(lisp_cadar(rest), &scope);
+	resolve_let_star(rest, body, &scope, context);
+	free(scope.defined);
+}
+static void resolve_exp(lisp_data_t *exp, const scope_t *scope, lisp_ctx_t *context) {
+	lisp_data_t *rest;
+
+	if(!exp || (lisp_type_of(exp) != lisp_type_pair))
+		return;
+
+	switch(get_keyword(exp)) {
+		case lisp_keyword_quote:
+			return;
+		case lisp_keyword_lambda:
+			resolve_body(get_lambda_parameters(exp), 0, NULL, get_lambda_body(exp), scope, context);
+			return;
+		case lisp_keyword_define:
+			if(is_symbol(lisp_cadr(exp)))
+				resolve_list(lisp_cddr(exp), scope, context);
+			else
+				resolve_body(lisp_cdadr(exp), 0, NULL, lisp_cddr(exp), scope, context);
+			return;
+		case lisp_keyword_set:
+			resolve_list(lisp_cddr(exp), scope, context);
+			return;
+		case lisp_keyword_let:
+			for(rest = get_let_assignment(exp); rest; rest = lisp_cdr(rest))
+				resolve_list(lisp_cdar(rest), scope, context);
+			resolve_body(get_let_assignment(exp), 1, NULL, get_let_body(exp), scope, context);
+			return;
+		case lisp_keyword_let_star:
+			resolve_let_star(get_let_star_assignment(exp), get_let_star_body(exp), scope, context);
+			return;
+		case lisp_keyword_letrec:
+			resolve_body(get_let_assignment(exp), 1, get_let_assignment(exp), get_let_body(exp), scope, context);
+			return;
+		case lisp_keyword_cond:
+			for(rest = get_cond_clauses(exp); rest; rest = lisp_cdr(rest))
+				resolve_list(lisp_car(rest), scope, context);
+			return;
+		default:
+			resolve_list(exp, scope, context);
+	}
+}
+static lisp_data_t *execute_lexical(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) {
+	unsigned int i, depth = node->node.a->lexical.depth, slot = node->node.a->lexical.slot;
+	lisp_data_t *frame;
+
+	for(i = 0; i < depth; i++)
+		env = get_enclosing_env(env);
+
+	frame = get_first_frame(env);
+	if(!has_slots(frame) || (slot >= frame->length))
+		return lisp_make_error("LOOKUP -- Unbound variable", context);
+	return lisp_frame_slots(frame)[slot];
+}
+/* A lambda outside of all others is evaluated in the global environment,
+ * so its body is resolved before it is analyzed. */
+static lisp_data_t *analyze_lambda(const lisp_data_t *exp, const int top, lisp_ctx_t *context) {
+	if(top)
+		resolve_body(get_lambda_parameters(exp), 0, NULL, get_lambda_body(exp), NULL, context);
+	return lisp_make_node(lisp_node_lambda, lisp_cons(get_lambda_parameters(exp), analyze_sequence(get_lambda_body(exp), 0, context)), NULL, context);
+}
+static lisp_data_t *execute_lambda(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) {
+	return make_procedure(node->node.a, env, context);
 }
 
 /* EVALUATOR PROPER */
@@ -326,72 +770,158 @@ lisp_data_t *extend_environment(const lisp_data_t *vars, const lisp_data_t *vals
 		return lisp_make_error("EXTEND -- Too few arguments", context);
 }
 
+/* Binds the parameters of proc in a new frame on top of its environment.
+ * Unless they are values already, the arguments are operand nodes executed
+ * in env from left to right and go straight into the slots of the frame, without being
+ * collected in a list first. Like apply(), returns the first argument that
+ * is an error, if there is one. */
+static lisp_data_t *bind_arguments(const lisp_data_t *proc, const lisp_data_t *args, const int evaluate, lisp_data_t *env, lisp_ctx_t *context) {
+	lisp_data_t *frame, *val, *error = NULL;
+	unsigned int i, n = get_procedure_arity(proc);
+
+	if((frame = lisp_make_frame(get_procedure_parameters(proc), n, context)) == NULL)
+		return lisp_make_error("EXTEND -- Could not allocate frame", context);
+
+	for(i = 0; args; i++, args = lisp_cdr(args)) {
+		val = evaluate ? execute(lisp_car(args), env, context) : lisp_car(args);
+		if(!error && is_error(val))
+			error = val;
+		if(i < n)
+			lisp_frame_set(frame, i, val);
+	}
+
+	if(error)
+		return error;
+	if(i < n)
+		return lisp_make_error("EXTEND -- Too few arguments", context);
+	if(i > n)
+		return lisp_make_error("EXTEND -- Too many arguments", context);
+	return lisp_cons(frame, get_procedure_environment(proc));
+}
+static lisp_data_t *eval_body(const lisp_data_t *proc, lisp_data_t *env, lisp_ctx_t *context) {
+	if(is_error(env))
+		return env;
+	return execute(get_procedure_body(proc), env, context);
+}
+
 static lisp_data_t *apply(const lisp_data_t *proc, const lisp_data_t *args, lisp_ctx_t *context) {
-	lisp_data_t *out;
 	lisp_data_t *argl = args, *currarg;
 
 	while(argl) {
 		currarg = lisp_car(argl);
-		if(currarg && (currarg->type == lisp_type_error))
+		if(currarg && (lisp_type_of(currarg) == lisp_type_error))
 			return currarg;
 		argl = lisp_cdr(argl);
 	}
 
-	if(is_primitive_procedure(proc))
-		return apply_primitive_procedure(proc, args, context);
-	if(is_compound_procedure(proc)) {
-		out = eval_sequence(
-			get_procedure_body(proc),
-			extend_environment(get_procedure_parameters(proc),
-				args,
-				get_procedure_environment(proc), context), context);		
-		return out;
+	if(proc) {
+		switch(lisp_type_of(proc)) {
+			case lisp_type_prim:
+				return apply_primitive_procedure(proc, args, context);
+			case lisp_type_closure:
+				return eval_body(proc, bind_arguments(proc, args, 0, NULL, context), context);
+			default:
+				break;
+		}
 	}
 	return lisp_make_error("APPLY -- Unknown procedure type", context);
 }
 
-static lisp_data_t *eval(const lisp_data_t *exp, lisp_data_t *env, lisp_ctx_t *context) {
-	if(context->eval_plz_die) {
-		context->eval_plz_die = 0;
-		ExitThread(0);
-	}
+/* While allocations are sampled, they are charged to the innermost compound
+ * procedure being applied, named after the operator of the application. */
+static lisp_data_t *execute_sampled_application(const lisp_data_t *node, lisp_data_t *proc, lisp_data_t *env, lisp_ctx_t *context) {
+	const lisp_data_t *op = node->node.a;
+	const char *caller = context->eval_proc;
+	lisp_data_t *out;
+
+	env = bind_arguments(proc, node->node.b, 1, env, context);
+	if(op->length == lisp_node_variable)
+		context->eval_proc = lisp_text(op->node.a);
+	else if(op->length == lisp_node_lexical)
+		context->eval_proc = lisp_text(op->node.a->lexical.symbol);
+	else if(op->length == lisp_node_global)
+		context->eval_proc = lisp_text(op->node.a->global.symbol);
+	else
+		context->eval_proc = "lambda";
+
+	out = eval_body(proc, env, context);
+	context->eval_proc = caller;
+
+	return out;
+}
+static lisp_data_t *execute_application(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) {
+	lisp_data_t *proc = execute(node->node.a, env, context);
 
-	if(is_error(exp))
-		return (lisp_data_t*)exp;
-	if(is_self_evaluating(exp))
-		return (lisp_data_t*)exp;
+	if(!is_compound_procedure(proc))
+		return apply(proc, get_list_of_values(node->node.b, env, context), context);
+	if(context->alloc_sample_bytes)
+		return execute_sampled_application(node, proc, env, context);
+	return eval_body(proc, bind_arguments(proc, node->node.b, 1, env, context), context);
+}
+
+/* Expressions are analyzed once into a tree of execution nodes, which are
+ * what gets executed, however often that is. Each node is tagged in ->length
+ * with its kind, which selects the handler that executes it. Derived forms
+ * are expanded during the analysis, so their code is built only once. top
+ * is set outside of all lambdas, where the code runs in the global
+ * environment. */
+static lisp_data_t *analyze(const lisp_data_t *exp, const int top, lisp_ctx_t *context) {
+	if(is_error(exp) || is_self_evaluating(exp))
+		return lisp_make_node(lisp_node_constant, exp, NULL, context);
 	if(is_variable(exp))
-		return lookup_variable_value(exp, env, context);
-	if(is_quoted_expression(exp))
-		return get_text_of_quotation(exp);
-	if(is_assignment(exp))
-		return eval_assignment(exp, env, context);
-	if(is_definition(exp))
-		return eval_definition(exp, env, context);
-	if(is_if(exp))
-		return eval_if(exp, env, context);
-	if(is_lambda(exp))
-		return make_procedure(get_lambda_parameters(exp), get_lambda_body(exp), env, context);
-	if(is_begin(exp))
-		return eval_sequence(get_begin_actions(exp), env, context);
-	if(is_cond(exp))
-		return eval(cond_to_if(exp, context), env, context);
-	if(is_letrec(exp))
-		return eval(letrec_to_let(exp, context), env, context);
-	if(is_let_star(exp))
-		return eval(let_star_to_nested_lets(exp, context), env, context);
-	if(is_let(exp))
-		return eval(let_to_combination(exp, context), env, context);
-	if(is_application(exp))		
-		return apply(
-			eval(get_operator(exp), env, context),
-			get_list_of_values(get_operands(exp), env, context), context);
+		return lisp_make_node(lisp_node_variable, exp, NULL, context);
+	if(lisp_type_of(exp) == lisp_type_lexical)
+		return lisp_make_node(lisp_node_lexical, exp, NULL, context);
+	if(lisp_type_of(exp) == lisp_type_global)
+		return lisp_make_node(lisp_node_global, exp, NULL, context);
+
+	switch(get_keyword(exp)) {
+		case lisp_keyword_quote:
+			return lisp_make_node(lisp_node_constant, get_text_of_quotation(exp), NULL, context);
+		case lisp_keyword_set:
+			return analyze_assignment(exp, top, context);
+		case lisp_keyword_define:
+			return analyze_definition(exp, top, context);
+		case lisp_keyword_if:
+			return analyze_if(exp, top, context);
+		case lisp_keyword_lambda:
+			return analyze_lambda(exp, top, context);
+		case lisp_keyword_begin:
+			return analyze_sequence(get_begin_actions(exp), top, context);
+		case lisp_keyword_cond:
+			return analyze(cond_to_if(exp, context), top, context);
+		case lisp_keyword_letrec:
+			return analyze(letrec_to_let(exp, context), top, context);
+		case lisp_keyword_let_star:
+			return analyze(let_star_to_nested_lets(exp, context), top, context);
+		case lisp_keyword_let:
+			return analyze(let_to_combination(exp, context), top, context);
+		default:
+			break;
+	}
+
+	if(is_application(exp))
+		return analyze_application(exp, top, context);
 	
-	return lisp_make_error("EVAL -- Unknown expression type", context);
+	return lisp_make_node(lisp_node_constant, lisp_make_error("EVAL -- Unknown expression type", context), NULL, context);
+}
+
+typedef lisp_data_t *(*handler_t)(const lisp_data_t*, lisp_data_t*, lisp_ctx_t*);
+
+static const handler_t handlers[lisp_n_node_kinds] = {
+	execute_constant, execute_variable, execute_lexical, execute_global, execute_assignment, execute_definition,
+	execute_if, execute_lambda, execute_sequence, execute_application
+};
+
+static lisp_data_t *execute(const lisp_data_t *node, lisp_data_t *env, lisp_ctx_t *context) {
+	if(context->eval_plz_die && context->eval_unwind)
+		longjmp(*context->eval_unwind, 1);
+
+	return handlers[node->length](node, env, context);
 }
 
 lisp_data_t *lisp_eval(const lisp_data_t *exp, lisp_ctx_t *context) {
-	return eval(exp, context->the_global_environment, context);
+	return execute(analyze(exp, 1, context), context->the_global_environment, context);
 }
 
 int lisp_run(const char *exp, lisp_ctx_t *context) {
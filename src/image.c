@@ -0,0 +1,653 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libisp/data.h"
+#include "libisp/eval.h"
+#include "libisp/image.h"
+#include "libisp/mem.h"
+
+/* An image holds everything reachable from the global environment. It starts
+ * with a header, followed by one record per object and the texts of all
+ * strings, symbols, errors and primitive procedures, each terminated by a
+ * zero, with the references to the values of every frame in between.
+ * References between objects are stored as the index of the record
+ * plus one, shifted left by three bits, so they can be told apart from NULL
+ * and from the immediates, which are stored as they are. Primitive
+ * procedures are stored by name and looked up in the loading context.
+ *
+ * Images are only portable between builds with the same word size, byte
+ * order and object layout. */
+
+#define IMAGE_MAGIC		"LISPIMG"
+#define IMAGE_VERSION	4
+
+#define encode_ref(i)	(((uint64_t)(i) + 1) << 3)
+#define is_ref(r)		((r) && !((r) & 7))
+#define ref_index(r)	(((r) >> 3) - 1)
+
+typedef struct image_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t word_size;
+	uint32_t data_size;
+	uint32_t record_size;
+	uint64_t n_records;
+	uint64_t text_bytes;
+	uint64_t root;
+} image_header_t;
+
+typedef struct image_record_t {
+	uint32_t type;
+	uint32_t length;
+	uint64_t a;
+	uint64_t b;
+} image_record_t;
+
+typedef struct image_writer_t {
+	const lisp_data_t **objects;
+	size_t n_objects;
+	size_t objects_size;
+	size_t *table;
+	size_t table_size;
+} image_writer_t;
+
+/* SAVING */
+
+static size_t hash_object(const lisp_data_t *d, const size_t table_size) {
+	return (size_t)(((uint64_t)(uintptr_t)d >> 3) * 0x9E3779B97F4A7C15ull) & (table_size - 1);
+}
+
+/* Returns the slot holding the index of d plus one, which is 0 if d has not
+ * been seen yet. */
+static size_t *find_object(const lisp_data_t *d, image_writer_t *writer) {
+	size_t i = hash_object(d, writer->table_size);
+
+	while(writer->table[i] && (writer->objects[writer->table[i] - 1] != d))
+		i = (i + 1) & (writer->table_size - 1);
+
+	return &writer->table[i];
+}
+
+static int grow_writer(image_writer_t *writer) {
+	const lisp_data_t **objects;
+	size_t i, size = writer->objects_size ? 2 * writer->objects_size : 1024;
+
+	if((objects = realloc(writer->objects, size * sizeof(lisp_data_t*))) == NULL)
+		return 0;
+	writer->objects = objects;
+	writer->objects_size = size;
+
+	free(writer->table);
+	writer->table_size = 2 * size;
+	if((writer->table = calloc(writer->table_size, sizeof(size_t))) == NULL)
+		return 0;
+	for(i = 0; i < writer->n_objects; i++)
+		*find_object(writer->objects[i], writer) = i + 1;
+
+	return 1;
+}
+
+/* Returns the encoded reference to d, adding it to the objects if it is new.
+ * Returns 0 if that fails. */
+static uint64_t add_object(const lisp_data_t *d, image_writer_t *writer) {
+	size_t *slot;
+
+	if(!d || lisp_is_immediate(d))
+		return (uint64_t)(uintptr_t)d;
+
+	if(*(slot = find_object(d, writer)))
+		return encode_ref(*slot - 1);
+
+	if(writer->n_objects == writer->objects_size) {
+		if(!grow_writer(writer))
+			return 0;
+		slot = find_object(d, writer);
+	}
+
+	writer->objects[writer->n_objects] = d;
+	*slot = ++writer->n_objects;
+	return encode_ref(writer->n_objects - 1);
+}
+
+static const char *prim_name(const lisp_prim_proc proc, lisp_ctx_t *context) {
+	lisp_prim_proc_list_t *curr_proc;
+
+	for(curr_proc = context->the_prim_procs; curr_proc; curr_proc = curr_proc->next)
+		if(curr_proc->proc == proc)
+			return curr_proc->name;
+
+	return NULL;
+}
+
+/* Collects the objects breadth first, the list of objects doubling as the
+ * queue. */
+static int collect_objects(const lisp_data_t *root, image_writer_t *writer) {
+	const lisp_data_t *d;
+	size_t i, n;
+
+	if(!add_object(root, writer) && root)
+		return 0;
+
+	for(i = 0; i < writer->n_objects; i++) {
+		d = writer->objects[i];
+		if((d->type == lisp_type_lexical) && !add_object(d->lexical.symbol, writer))
+			return 0;
+		if((d->type == lisp_type_global) && !add_object(d->global.symbol, writer))
+			return 0;
+		if((d->type == lisp_type_closure) && ((!add_object(d->closure.lambda, writer) && d->closure.lambda) || (!add_object(d->closure.env, writer) && d->closure.env)))
+			return 0;
+		if((d->type == lisp_type_node) && ((!add_object(d->node.a, writer) && d->node.a) || (!add_object(d->node.b, writer) && d->node.b)))
+			return 0;
+		if(d->type == lisp_type_frame) {
+			if(!add_object(d->frame.vars, writer) && d->frame.vars)
+				return 0;
+			for(n = 0; n < d->length; n++)
+				if(!add_object(lisp_frame_slots(d)[n], writer) && lisp_frame_slots(d)[n])
+					return 0;
+		}
+		if(d->type != lisp_type_pair)
+			continue;
+		if((!add_object(d->pair.l, writer) && d->pair.l) || (!add_object(d->pair.r, writer) && d->pair.r))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int write_records(FILE *fp, image_writer_t *writer, uint64_t *text_bytes, lisp_ctx_t *context) {
+	image_record_t record;
+	const lisp_data_t *d;
+	const char *name;
+	size_t i;
+
+	*text_bytes = 0;
+	for(i = 0; i < writer->n_objects; i++) {
+		d = writer->objects[i];
+		memset(&record, 0, sizeof(image_record_t));
+		record.type = d->type;
+
+		switch(d->type) {
+			case lisp_type_integer:
+				record.a = (uint64_t)(int64_t)d->integer;
+				break;
+			case lisp_type_decimal:
+				memcpy(&record.a, &d->decimal, sizeof(double));
+				break;
+			case lisp_type_string:
+			case lisp_type_symbol:
+			case lisp_type_error:
+				record.length = d->length;
+				record.a = *text_bytes;
+				*text_bytes += d->length + 1;
+				break;
+			case lisp_type_prim:
+				if((name = prim_name(d->proc, context)) == NULL) {
+					fprintf(stderr, "ERROR: Cannot save an unregistered primitive procedure.\n");
+					return 0;
+				}
+				record.length = (uint32_t)strlen(name);
+				record.a = *text_bytes;
+				*text_bytes += record.length + 1;
+				break;
+			case lisp_type_pair:
+				record.a = add_object(d->pair.l, writer);
+				record.b = add_object(d->pair.r, writer);
+				break;
+			case lisp_type_lexical:
+				record.length = d->lexical.depth;
+				record.a = d->lexical.slot;
+				record.b = add_object(d->lexical.symbol, writer);
+				break;
+			case lisp_type_global:
+				record.a = add_object(d->global.symbol, writer);
+				break;
+			case lisp_type_frame:
+				record.length = d->length;
+				record.a = *text_bytes;
+				record.b = add_object(d->frame.vars, writer);
+				*text_bytes += (uint64_t)d->length * sizeof(uint64_t);
+				break;
+			case lisp_type_closure:
+				record.length = d->length;
+				record.a = add_object(d->closure.lambda, writer);
+				record.b = add_object(d->closure.env, writer);
+				break;
+			case lisp_type_node:
+				record.length = d->length;
+				record.a = add_object(d->node.a, writer);
+				record.b = add_object(d->node.b, writer);
+				break;
+			default:
+				break;
+		}
+
+		if(fwrite(&record, sizeof(image_record_t), 1, fp) != 1)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int write_slots(FILE *fp, const lisp_data_t *frame, image_writer_t *writer) {
+	uint64_t ref;
+	unsigned int i;
+
+	for(i = 0; i < frame->length; i++) {
+		ref = add_object(lisp_frame_slots(frame)[i], writer);
+		if(fwrite(&ref, sizeof(uint64_t), 1, fp) != 1)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int write_texts(FILE *fp, image_writer_t *writer, lisp_ctx_t *context) {
+	const lisp_data_t *d;
+	const char *text;
+	size_t i, length;
+
+	for(i = 0; i < writer->n_objects; i++) {
+		d = writer->objects[i];
+		if(d->type == lisp_type_frame) {
+			if(!write_slots(fp, d, writer))
+				return 0;
+			continue;
+		}
+
+		if(d->type == lisp_type_prim) {
+			text = prim_name(d->proc, context);
+			length = strlen(text);
+		} else if((d->type == lisp_type_string) || (d->type == lisp_type_symbol) || (d->type == lisp_type_error)) {
+			text = lisp_text(d);
+			length = lisp_text_length(d);
+		} else {
+			continue;
+		}
+
+		if(fwrite(text, 1, length + 1, fp) != length + 1)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Writes the global environment to path. Returns 0 on failure. */
+int lisp_save_image(const char *path, lisp_ctx_t *context) {
+	image_writer_t writer;
+	image_header_t header;
+	FILE *fp;
+	int out = 0;
+
+	memset(&writer, 0, sizeof(image_writer_t));
+	memset(&header, 0, sizeof(image_header_t));
+
+	if(!grow_writer(&writer) || !collect_objects(context->the_global_environment, &writer)) {
+		fprintf(stderr, "ERROR: Could not allocate memory for the image.\n");
+		goto end;
+	}
+
+	if((fp = fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "ERROR: Could not open %s.\n", path);
+		goto end;
+	}
+
+	memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+	header.version = IMAGE_VERSION;
+	header.word_size = sizeof(void*);
+	header.data_size = sizeof(lisp_data_t);
+	header.record_size = sizeof(image_record_t);
+	header.n_records = writer.n_objects;
+	header.root = add_object(context->the_global_environment, &writer);
+
+	/* The header is written again once the size of the texts is known. */
+	out = (fwrite(&header, sizeof(image_header_t), 1, fp) == 1)
+		&& write_records(fp, &writer, &header.text_bytes, context)
+		&& write_texts(fp, &writer, context)
+		&& !fseek(fp, 0, SEEK_SET)
+		&& (fwrite(&header, sizeof(image_header_t), 1, fp) == 1);
+
+	if(fclose(fp) || !out) {
+		fprintf(stderr, "ERROR: Could not write %s.\n", path);
+		out = 0;
+	}
+
+end:
+	free(writer.objects);
+	free(writer.table);
+	return out;
+}
+
+/* LOADING */
+
+#ifdef _WIN32
+static const char *map_image(const char *path, size_t *size) {
+	FILE *fp;
+	char *out;
+	long length;
+
+	if((fp = fopen(path, "rb")) == NULL)
+		return NULL;
+	if(fseek(fp, 0, SEEK_END) || ((length = ftell(fp)) < 0) || fseek(fp, 0, SEEK_SET)) {
+		fclose(fp);
+		return NULL;
+	}
+	if((out = malloc(length ? length : 1)) && (fread(out, 1, length, fp) != (size_t)length)) {
+		free(out);
+		out = NULL;
+	}
+	fclose(fp);
+
+	*size = length;
+	return out;
+}
+
+static void unmap_image(const char *image, const size_t size) {
+	free((char*)image);
+}
+#else
+static const char *map_image(const char *path, size_t *size) {
+	struct stat st;
+	void *out;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if(fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return NULL;
+	}
+
+	out = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(out == MAP_FAILED)
+		return NULL;
+
+	*size = st.st_size;
+	return out;
+}
+
+static void unmap_image(const char *image, const size_t size) {
+	munmap((void*)image, size);
+}
+#endif
+
+static int check_header(const image_header_t *header, const size_t size) {
+	if(size < sizeof(image_header_t))
+		return 0;
+	if(memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) || (header->version != IMAGE_VERSION))
+		return 0;
+	if((header->word_size != sizeof(void*)) || (header->data_size != sizeof(lisp_data_t)) || (header->record_size != sizeof(image_record_t)))
+		return 0;
+	if(header->n_records > (size - sizeof(image_header_t)) / sizeof(image_record_t))
+		return 0;
+
+	return header->text_bytes == size - sizeof(image_header_t) - header->n_records * sizeof(image_record_t);
+}
+
+static const char *get_text(const image_record_t *record, const char *texts, const uint64_t text_bytes) {
+	if((record->a >= text_bytes) || (record->length >= text_bytes - record->a) || texts[record->a + record->length])
+		return NULL;
+	return texts + record->a;
+}
+
+static lisp_prim_proc find_prim(const char *name, lisp_ctx_t *context) {
+	lisp_prim_proc_list_t *curr_proc;
+
+	for(curr_proc = context->the_prim_procs; curr_proc; curr_proc = curr_proc->next)
+		if(!strcmp(curr_proc->name, name))
+			return curr_proc->proc;
+
+	return NULL;
+}
+
+static lisp_data_t *make_object(const image_record_t *record, const char *texts, const uint64_t text_bytes, lisp_ctx_t *context) {
+	const char *text = NULL;
+	lisp_prim_proc proc;
+	lisp_data_t *out;
+	double decimal;
+
+	if((record->type == lisp_type_string) || (record->type == lisp_type_symbol) || (record->type == lisp_type_error) || (record->type == lisp_type_prim))
+		if((text = get_text(record, texts, text_bytes)) == NULL)
+			return NULL;
+
+	switch(record->type) {
+		case lisp_type_integer:
+			return lisp_make_int((int)(int64_t)record->a, context);
+		case lisp_type_decimal:
+			memcpy(&decimal, &record->a, sizeof(double));
+			return lisp_make_decimal(decimal, context);
+		case lisp_type_string:
+			return lisp_make_string_n(text, record->length, context);
+		case lisp_type_symbol:
+			return lisp_make_symbol_n(text, record->length, context);
+		case lisp_type_error:
+			return lisp_make_error(text, context);
+		case lisp_type_prim:
+			if((proc = find_prim(text, context)) == NULL) {
+				fprintf(stderr, "ERROR: Unknown primitive procedure %s in image.\n", text);
+				return NULL;
+			}
+			return lisp_make_prim(proc, context);
+		case lisp_type_lexical:
+			if(record->a > UINT_MAX)
+				return NULL;
+			return lisp_make_lexical(record->length, (unsigned int)record->a, NULL, context);
+		case lisp_type_global:
+			return lisp_make_global(NULL, context);
+		case lisp_type_frame:
+			if((record->a > text_bytes) || (record->length > (text_bytes - record->a) / sizeof(uint64_t)))
+				return NULL;
+			return lisp_make_frame(NULL, record->length, context);
+		case lisp_type_closure:
+			return lisp_make_closure(NULL, NULL, context);
+		case lisp_type_node:
+			if(record->length >= lisp_n_node_kinds)
+				return NULL;
+			return lisp_make_node(record->length, NULL, NULL, context);
+		case lisp_type_pair:
+			if((out = lisp_data_alloc(sizeof(lisp_data_t), context)) == NULL)
+				return NULL;
+			out->type = lisp_type_pair;
+			out->pair.l = NULL;
+			out->pair.r = NULL;
+			return out;
+	}
+
+	return NULL;
+}
+
+static int resolve(const uint64_t ref, lisp_data_t **objects, const uint64_t n_objects, lisp_data_t **out) {
+	if(!is_ref(ref)) {
+		*out = (lisp_data_t*)(uintptr_t)ref;
+		return 1;
+	}
+	if(ref_index(ref) >= n_objects)
+		return 0;
+
+	*out = objects[ref_index(ref)];
+	return 1;
+}
+
+/* The references to the values are not aligned within the texts. */
+static int resolve_frame(const image_record_t *record, const char *texts, lisp_data_t **objects, const uint64_t n_objects, lisp_data_t *frame) {
+	uint64_t ref;
+	unsigned int i;
+
+	if(!resolve(record->b, objects, n_objects, &frame->frame.vars))
+		return 0;
+	for(i = 0; i < record->length; i++) {
+		memcpy(&ref, texts + record->a + i * sizeof(uint64_t), sizeof(uint64_t));
+		if(!resolve(ref, objects, n_objects, &lisp_frame_slots(frame)[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int resolve_lexical(const image_record_t *record, lisp_data_t **objects, const uint64_t n_objects, lisp_data_t *lexical) {
+	if(!resolve(record->b, objects, n_objects, &lexical->lexical.symbol) || !lexical->lexical.symbol)
+		return 0;
+	return lisp_type_of(lexical->lexical.symbol) == lisp_type_symbol;
+}
+
+/* Global references are saved without their cell and looked up again. */
+static int resolve_global(const image_record_t *record, lisp_data_t **objects, const uint64_t n_objects, lisp_data_t *global) {
+	if(!resolve(record->a, objects, n_objects, &global->global.symbol) || !global->global.symbol)
+		return 0;
+	return lisp_type_of(global->global.symbol) == lisp_type_symbol;
+}
+
+/* Like lisp_type_of(), but safe for NULL, which has no type. */
+static int type_of(const lisp_data_t *d) {
+	return d ? (int)lisp_type_of(d) : -1;
+}
+
+/* Returns 0 unless list is a proper list no longer than the image, and with
+ * only nodes in it if nodes is set. */
+static int check_list(const lisp_data_t *list, const int nodes, const uint64_t n_objects) {
+	uint64_t i;
+
+	for(i = 0; list && (i < n_objects); i++, list = list->pair.r)
+		if((type_of(list) != lisp_type_pair) || (nodes && (type_of(list->pair.l) != lisp_type_node)))
+			return 0;
+	return list == NULL;
+}
+
+/* lambda is the (parameters . body) pair of a closure or lambda node. */
+static int check_lambda(const lisp_data_t *lambda, const uint64_t n_objects) {
+	if((type_of(lambda) != lisp_type_pair) || (type_of(lambda->pair.r) != lisp_type_node))
+		return 0;
+	return (type_of(lambda->pair.l) != lisp_type_pair) || check_list(lambda->pair.l, 0, n_objects);
+}
+
+/* Closures and nodes are executed without checking what they hold, so they
+ * are only accepted holding what the evaluator puts there. The arity of a
+ * closure is counted from its parameters like lisp_make_closure() does. */
+static int check_object(lisp_data_t *d, const uint64_t n_objects) {
+	const lisp_data_t *a, *b;
+
+	if(d->type == lisp_type_closure) {
+		if(!check_lambda(d->closure.lambda, n_objects) || (d->closure.env && (type_of(d->closure.env) != lisp_type_pair)))
+			return 0;
+		d->length = (unsigned int)lisp_list_length(lisp_car(d->closure.lambda));
+		return 1;
+	}
+	if(d->type != lisp_type_node)
+		return 1;
+
+	a = d->node.a;
+	b = d->node.b;
+	switch(d->length) {
+		case lisp_node_constant:
+			return b == NULL;
+		case lisp_node_variable:
+			return (type_of(a) == lisp_type_symbol) && !b;
+		case lisp_node_lexical:
+			return (type_of(a) == lisp_type_lexical) && !b;
+		case lisp_node_global:
+			return (type_of(a) == lisp_type_global) && !b;
+		case lisp_node_set:
+		case lisp_node_define:
+			return type_of(b) == lisp_type_node;
+		case lisp_node_if:
+			return (type_of(a) == lisp_type_node) && (type_of(b) == lisp_type_pair)
+				&& (type_of(b->pair.l) == lisp_type_node) && (type_of(b->pair.r) == lisp_type_node);
+		case lisp_node_lambda:
+			return check_lambda(a, n_objects) && !b;
+		case lisp_node_sequence:
+			return check_list(a, 1, n_objects) && !b;
+		case lisp_node_application:
+			return (type_of(a) == lisp_type_node) && check_list(b, 1, n_objects);
+	}
+
+	return 0;
+}
+
+/* Rebuilds the objects of the image at path in the heap of context and
+ * returns what was the global environment, or NULL on failure. Objects are
+ * not collected outside of an evaluation, so those made so far need no
+ * protection. */
+lisp_data_t *lisp_read_image(const char *path, lisp_ctx_t *context) {
+	const image_header_t *header;
+	const image_record_t *records;
+	const char *image, *texts;
+	lisp_data_t **objects = NULL, *out = NULL;
+	size_t size;
+	uint64_t i;
+
+	if((image = map_image(path, &size)) == NULL) {
+		fprintf(stderr, "ERROR: Could not read %s.\n", path);
+		return NULL;
+	}
+
+	header = (const image_header_t*)image;
+	if(!check_header(header, size)) {
+		fprintf(stderr, "ERROR: %s is not an image of this build.\n", path);
+		unmap_image(image, size);
+		return NULL;
+	}
+
+	records = (const image_record_t*)(image + sizeof(image_header_t));
+	texts = (const char*)(records + header->n_records);
+
+	if(header->n_records && ((objects = malloc(header->n_records * sizeof(lisp_data_t*))) == NULL))
+		goto end;
+
+	for(i = 0; i < header->n_records; i++)
+		if((objects[i] = make_object(&records[i], texts, header->text_bytes, context)) == NULL)
+			goto end;
+
+	for(i = 0; i < header->n_records; i++) {
+		if((records[i].type == lisp_type_frame) && !resolve_frame(&records[i], texts, objects, header->n_records, objects[i]))
+			goto end;
+		if((records[i].type == lisp_type_lexical) && !resolve_lexical(&records[i], objects, header->n_records, objects[i]))
+			goto end;
+		if((records[i].type == lisp_type_global) && !resolve_global(&records[i], objects, header->n_records, objects[i]))
+			goto end;
+		if((records[i].type == lisp_type_closure) && (!resolve(records[i].a, objects, header->n_records, &objects[i]->closure.lambda) || !resolve(records[i].b, objects, header->n_records, &objects[i]->closure.env)))
+			goto end;
+		if((records[i].type == lisp_type_node) && (!resolve(records[i].a, objects, header->n_records, &objects[i]->node.a) || !resolve(records[i].b, objects, header->n_records, &objects[i]->node.b)))
+			goto end;
+		if(records[i].type != lisp_type_pair)
+			continue;
+		if(!resolve(records[i].a, objects, header->n_records, &objects[i]->pair.l) || !resolve(records[i].b, objects, header->n_records, &objects[i]->pair.r))
+			goto end;
+	}
+
+	for(i = 0; i < header->n_records; i++)
+		if(!check_object(objects[i], header->n_records))
+			goto end;
+
+	if(!resolve(header->root, objects, header->n_records, &out))
+		out = NULL;
+
+end:
+	if(!out)
+		fprintf(stderr, "ERROR: Could not load %s.\n", path);
+	free(objects);
+	unmap_image(image, size);
+	return out;
+}
@@ -9,250 +9,2533 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details.
  */
 
+#ifdef _WIN32
+#include <Windows.h>
+#include <malloc.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+#include <setjmp.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "libisp/builtin.h"
-#include "libisp/data.h"
-#include "libisp/eval.h"
-#include "libisp/mem.h"
-#include "libisp/thread.h"
+#include "libisp/builtin.h"
+#include "libisp/data.h"
+#include "libisp/eval.h"
+#include "libisp/mem.h"
+#include "libisp/thread.h"
+
+/* Cells are handed out from pages of LISP_PAGE_SIZE bytes. Every page holds
+ * cells of a single kind and is aligned to its own size, so the page header
+ * of any cell is found by masking its address. The header keeps one bit per
+ * cell in the allocation and mark bitmaps.
+ *
+ * The collector is generational with sticky mark bits: an object whose mark
+ * bit is set has survived a collection and is old, everything else is young.
+ * Young objects are bump-allocated from empty pages (the nursery) or taken
+ * from the free lists of pages with holes. A minor collection only traces
+ * young objects reachable from the roots and from the remembered set, i.e.
+ * old objects that had a young object stored into them, and only sweeps the
+ * pages that were allocated from since the last collection.
+ *
+ * If gc_pause_budget_us is set, full collections run incrementally: every
+ * call to lisp_gc() advances the cycle by one slice of at most that many
+ * microseconds. A cycle clears the mark bits page by page, then runs the
+ * tri-color mark and finally sweeps, checking the deadline every few words
+ * of a page. While marking, the write barrier shades every white object
+ * stored into a marked one. Stores into the stack have no barrier, so the
+ * mark only ends in a slice that scans the stack and then empties the mark
+ * stack before its deadline. Dead symbols stay in the table until their
+ * cells are swept, but are no longer found. A minor collection cannot be
+ * split, so with a budget there are none: a cycle starts whenever more than
+ * mem_lim_soft is in use, and while it runs the evaluator takes a slice for
+ * every page it allocates.
+ *
+ * With more than one gc_thread, stop-the-world full collections mark in
+ * parallel, every thread working off its own deque and stealing from the
+ * others when it runs dry, and then sweep the pages in parallel.
+ *
+ * Full collections started by LISP_GC_LOWMEM do not sweep at all. The pages
+ * holding dead cells are flagged unswept and mem_allocated is set to the
+ * bytes still marked; each page is then swept the next time the allocator
+ * takes a cell from it. Anything that clears the mark bits sweeps all
+ * remaining pages first.
+ *
+ * If gc_copying is set, full collections evacuate the marked objects into
+ * fresh pages instead of sweeping, in the order of a Cheney scan with the cdr
+ * of every pair copied before its car, so list spines end up in consecutive
+ * cells. The remembered bits of the old pages serve as
+ * forwarding flags and the forwarding address is stored in the cell itself.
+ * If the new pages cannot be reserved, the collection sweeps as usual.
+ *
+ * While lisp_eval_thread() runs, the stack of the evaluating thread is an
+ * additional root: every word on it that points into an allocated cell keeps
+ * that cell alive. This lets the allocator collect at safepoints in the
+ * middle of an evaluation, once more than mem_lim_soft is in use and another
+ * nursery worth of memory has been allocated. Since the stack is scanned
+ * conservatively, such collections never copy.
+ *
+ * If alloc_sample_bytes is set, one allocation out of every that many bytes
+ * is recorded with its C call site and the compound procedure being applied,
+ * and stands in for all the bytes allocated since the previous sample.
+ *
+ * Texts too long to be stored in their cell are carved from chunks of
+ * STRING_CHUNK bytes. Every block is prefixed with the length of its text and
+ * belongs to one of STRING_CLASSES power-of-two size classes, and a freed
+ * block goes onto the free list of its class when its cell is swept. Longer
+ * texts get a block of their own from malloc(). The slots of frames too large
+ * for their cell are kept in such blocks as well; unlike texts, they count
+ * towards mem_allocated and the limits.
+ *
+ * Every symbol is interned in a hash table of the heap, so there is only one
+ * object per name. The table does not keep its symbols alive: once marking
+ * is done, symbols left unmarked are dropped from it before they are swept,
+ * and symbols that are moved by the copying collector or promoted out of an
+ * arena are updated. */
+
+#define LISP_PAGE_SIZE	65536
+#define MIN_CELL_SIZE	16
+#define BITMAP_WORDS	(LISP_PAGE_SIZE / MIN_CELL_SIZE / 32)
+#define NURSERY_PAGES	8
+#define SAFEPOINT_BYTES	(NURSERY_PAGES * LISP_PAGE_SIZE)
+#define SAMPLE_BUCKETS	256
+#define SLICE_CHECK		256
+#define STRING_CHUNK	65536
+#define STRING_CLASSES	8
+#define MIN_STRING_SIZE	32
+#define MIN_SYMBOLS		256
+#define DEAD_SYMBOL		((lisp_data_t*)1)
+
+#define get_bit(map, i)		((map)[(i) >> 5] & (1u << ((i) & 31)))
+#define set_bit(map, i)		((map)[(i) >> 5] |= (1u << ((i) & 31)))
+#define clear_bit(map, i)	((map)[(i) >> 5] &= ~(1u << ((i) & 31)))
+
+#ifdef _WIN32
+#define atomic_or(p, v)		((uint32_t)_InterlockedOr((volatile long*)(p), (long)(v)))
+#define atomic_add(p, v)	_InterlockedExchangeAdd((p), (v))
+#define atomic_get(p)		_InterlockedCompareExchange((volatile long*)(p), 0, 0)
+#define yield_thread()		SwitchToThread()
+typedef CRITICAL_SECTION gc_lock_t;
+#define init_lock(l)		InitializeCriticalSection(l)
+#define destroy_lock(l)		DeleteCriticalSection(l)
+#define lock(l)				EnterCriticalSection(l)
+#define unlock(l)			LeaveCriticalSection(l)
+typedef DWORD thread_id_t;
+#define current_thread()	GetCurrentThreadId()
+#define same_thread(a, b)	((a) == (b))
+#else
+#define atomic_or(p, v)		__atomic_fetch_or((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_add(p, v)	__atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_get(p)		__atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define yield_thread()		sched_yield()
+typedef pthread_mutex_t gc_lock_t;
+#define init_lock(l)		pthread_mutex_init((l), NULL)
+#define destroy_lock(l)		pthread_mutex_destroy(l)
+#define lock(l)				pthread_mutex_lock(l)
+#define unlock(l)			pthread_mutex_unlock(l)
+typedef pthread_t thread_id_t;
+#define current_thread()	pthread_self()
+#define same_thread(a, b)	pthread_equal((a), (b))
+#endif
+
+/* Reading the whole stack trips AddressSanitizer on the redzones of other
+ * frames. */
+#ifdef __SANITIZE_ADDRESS__
+#define NO_SANITIZE_ADDRESS	__attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+typedef enum cell_kind_t {
+	cell_kind_data, n_cell_kinds
+} cell_kind_t;
+
+typedef enum gc_phase_t {
+	gc_phase_idle, gc_phase_clearing, gc_phase_marking, gc_phase_sweeping
+} gc_phase_t;
+
+typedef struct free_cell_t {
+	struct free_cell_t *next;
+} free_cell_t;
+
+typedef struct string_block_t {
+	union {
+		size_t length;
+		struct string_block_t *next;
+	};
+	char text[];
+} string_block_t;
+
+typedef struct page_t {
+	char *cells;
+	struct lisp_heap_t *heap;
+	cell_kind_t kind;
+	size_t cell_size;
+	size_t n_cells;
+	size_t n_used;
+	size_t bump;
+	free_cell_t *free;
+	int young;
+	int unswept;
+	int arena;
+	uint32_t alloc_bits[BITMAP_WORDS];
+	uint32_t mark_bits[BITMAP_WORDS];
+	uint32_t remembered_bits[BITMAP_WORDS];
+#ifdef LISP_MEM_DEBUG
+	const char **file;
+	int *line;
+#endif
+	struct page_t *next;
+	struct page_t *next_avail;
+	struct page_t *next_young;
+} page_t;
+
+typedef struct gc_cycle_t {
+	size_t objects_marked;
+	size_t bytes_marked;
+	size_t objects_swept;
+	size_t bytes_swept;
+} gc_cycle_t;
+
+typedef struct arena_t {
+	page_t *pages;
+	size_t n_cells;
+	lisp_data_t **escapes;
+	size_t escapes_size;
+	size_t escapes_top;
+} arena_t;
+
+typedef struct sample_t {
+	const char *file;
+	int line;
+	char *proc;
+	size_t bytes;
+	size_t objects;
+	struct sample_t *next;
+} sample_t;
+
+#define PAGE_HEADER_SIZE	((sizeof(page_t) + MIN_CELL_SIZE - 1) & ~(size_t)(MIN_CELL_SIZE - 1))
+#define page_of(memory)		((page_t*)((uintptr_t)(memory) & ~(uintptr_t)(LISP_PAGE_SIZE - 1)))
+#define is_heap(d)			((d) && !lisp_is_immediate(d))
+#define has_fields(d)		(((d)->type == lisp_type_frame) || ((d)->type == lisp_type_lexical) || ((d)->type == lisp_type_global) || ((d)->type == lisp_type_closure) || ((d)->type == lisp_type_node))
+
+typedef struct lisp_heap_t {
+	page_t *pages[n_cell_kinds];
+	page_t *avail[n_cell_kinds];
+	page_t *young;
+	size_t young_bytes;
+
+	page_t **table;
+	size_t table_size;
+	size_t n_pages;
+
+	lisp_data_t **mark_stack;
+	size_t mark_stack_size;
+	size_t mark_stack_top;
+	int mark_overflow;
+
+	lisp_data_t **remembered;
+	size_t remembered_size;
+	size_t remembered_top;
+
+	gc_phase_t phase;
+	page_t *sweep_cursor;
+	size_t sweep_word;
+	gc_cycle_t cycle;
+	page_t *spare_pages;
+
+	void *stack_base;
+	thread_id_t stack_thread;
+	size_t safepoint_bytes;
+	arena_t *arena;
+
+	sample_t *samples[SAMPLE_BUCKETS];
+	size_t n_samples;
+	size_t sample_left;
+
+	string_block_t *string_free[STRING_CLASSES];
+	char *string_chunks;
+	char *string_bump;
+	size_t string_left;
+	size_t string_reserved;
+	gc_lock_t string_lock;
+	size_t slot_bytes;
+
+	lisp_data_t **symbols;
+	size_t symbols_size;
+	size_t n_symbols;
+	size_t n_dead_symbols;
+
+	size_t n_full_gcs;
+	uint64_t full_gc_us;
+	size_t bytes_marked;
+	size_t bytes_swept;
+} lisp_heap_t;
+
+static const size_t cell_sizes[n_cell_kinds] = { sizeof(lisp_data_t) };
+
+/* PAGES */
+
+static void *alloc_aligned(const size_t size) {
+#ifdef _WIN32
+	return _aligned_malloc(size, size);
+#else
+	void *out;
+
+	if(posix_memalign(&out, size, size))
+		return NULL;
+	return out;
+#endif
+}
+
+static void free_aligned(void *memory) {
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
+static size_t page_hash(const page_t *page, const size_t table_size) {
+	return (size_t)(((uintptr_t)page / LISP_PAGE_SIZE) * 2654435761u) & (table_size - 1);
+}
+
+static void table_put(page_t *page, lisp_heap_t *heap) {
+	size_t pos = page_hash(page, heap->table_size);
+
+	while(heap->table[pos])
+		pos = (pos + 1) & (heap->table_size - 1);
+	heap->table[pos] = page;
+}
+
+static int insert_page(page_t *page, lisp_heap_t *heap) {
+	page_t **old_table = heap->table;
+	size_t old_size = heap->table_size, i;
+
+	if(2 * (heap->n_pages + 1) > heap->table_size) {
+		heap->table_size = old_size ? 2 * old_size : 64;
+		if((heap->table = calloc(heap->table_size, sizeof(page_t*))) == NULL) {
+			heap->table = old_table;
+			heap->table_size = old_size;
+			return 0;
+		}
+
+		for(i = 0; i < old_size; i++)
+			if(old_table[i])
+				table_put(old_table[i], heap);
+		free(old_table);
+	}
+
+	table_put(page, heap);
+	heap->n_pages++;
+
+	return 1;
+}
+
+static void remove_page(page_t *page, lisp_heap_t *heap) {
+	size_t pos = page_hash(page, heap->table_size);
+	page_t *moved;
+
+	while(heap->table[pos] != page)
+		pos = (pos + 1) & (heap->table_size - 1);
+	heap->table[pos] = NULL;
+	heap->n_pages--;
+
+	pos = (pos + 1) & (heap->table_size - 1);
+	while((moved = heap->table[pos])) {
+		heap->table[pos] = NULL;
+		table_put(moved, heap);
+		pos = (pos + 1) & (heap->table_size - 1);
+	}
+}
+
+/* Checks that memory lies within a known page before touching its header. */
+static page_t *find_page(const void *memory, lisp_heap_t *heap) {
+	page_t *page = page_of(memory);
+	size_t pos;
+
+	if(!memory || !heap->table_size)
+		return NULL;
+
+	pos = page_hash(page, heap->table_size);
+	while(heap->table[pos]) {
+		if(heap->table[pos] == page)
+			return page;
+		pos = (pos + 1) & (heap->table_size - 1);
+	}
+
+	return NULL;
+}
+
+static void free_page(page_t *page) {
+#ifdef LISP_MEM_DEBUG
+	free(page->file);
+	free(page->line);
+#endif
+	free_aligned(page);
+}
+
+static page_t *make_page(const cell_kind_t kind, lisp_heap_t *heap) {
+	page_t *page;
+
+	if((page = alloc_aligned(LISP_PAGE_SIZE)) == NULL)
+		return NULL;
+
+	memset(page, 0, sizeof(page_t));
+	page->heap = heap;
+	page->kind = kind;
+	page->cell_size = cell_sizes[kind];
+	page->cells = (char*)page + PAGE_HEADER_SIZE;
+	page->n_cells = (LISP_PAGE_SIZE - PAGE_HEADER_SIZE) / page->cell_size;
+#ifdef LISP_MEM_DEBUG
+	page->file = calloc(page->n_cells, sizeof(char*));
+	page->line = calloc(page->n_cells, sizeof(int));
+	if(!page->file || !page->line) {
+		free_page(page);
+		return NULL;
+	}
+#endif
+
+	return page;
+}
+
+static page_t *new_page(const cell_kind_t kind, lisp_heap_t *heap) {
+	page_t *page;
+
+	if((page = make_page(kind, heap)) == NULL)
+		return NULL;
+	if(!insert_page(page, heap)) {
+		free_page(page);
+		return NULL;
+	}
+
+	page->next = heap->pages[kind];
+	heap->pages[kind] = page;
+	page->next_avail = heap->avail[kind];
+	heap->avail[kind] = page;
+
+	return page;
+}
+
+static size_t cell_index(const void *memory, const page_t *page) {
+	return ((char*)memory - page->cells) / page->cell_size;
+}
+
+/* Rebuilds the per-kind page lists after a collection. Empty pages go to the
+ * front of the allocation list, so the next young objects are bump-allocated
+ * from them; pages with holes follow. Empty pages beyond the nursery size are
+ * returned to the system. */
+static void rebuild_page_lists(lisp_heap_t *heap) {
+	page_t *page, *buf, **link, *empty, *partial, *last_empty;
+	size_t n_empty;
+	int kind;
+
+	for(page = heap->young; page; page = buf) {
+		buf = page->next_young;
+		page->young = 0;
+		page->next_young = NULL;
+	}
+	heap->young = NULL;
+	heap->young_bytes = 0;
+
+	for(kind = 0; kind < n_cell_kinds; kind++) {
+		empty = partial = last_empty = NULL;
+		n_empty = 0;
+		link = &heap->pages[kind];
+
+		while((page = *link)) {
+			if(page->n_used == 0) {
+				if(n_empty == NURSERY_PAGES) {
+					*link = page->next;
+					remove_page(page, heap);
+					page->next = heap->spare_pages;
+					heap->spare_pages = page;
+					continue;
+				}
+				page->bump = 0;
+				page->free = NULL;
+				memset(page->mark_bits, 0, sizeof(page->mark_bits));
+				page->next_avail = empty;
+				if(!empty)
+					last_empty = page;
+				empty = page;
+				n_empty++;
+			} else if(page->unswept || page->free || (page->bump < page->n_cells)) {
+				page->next_avail = partial;
+				partial = page;
+			}
+			link = &page->next;
+		}
+
+		if(last_empty) {
+			last_empty->next_avail = partial;
+			heap->avail[kind] = empty;
+		} else
+			heap->avail[kind] = partial;
+	}
+}
+
+/* ALLOCATOR */
+
+static lisp_heap_t *get_heap(lisp_ctx_t *context) {
+	if(!context->heap && (context->heap = calloc(1, sizeof(lisp_heap_t))))
+		init_lock(&context->heap->string_lock);
+	return context->heap;
+}
+
+static void lazy_sweep(page_t *page, lisp_ctx_t *context);
+static void *arena_alloc(lisp_ctx_t *context);
+
+static void *alloc_cell(const cell_kind_t kind, lisp_ctx_t *context) {
+	lisp_heap_t *heap = get_heap(context);
+	page_t *page;
+	void *cell;
+	size_t i;
+
+	if(!heap)
+		return NULL;
+
+	while((page = heap->avail[kind])) {
+		if(page->unswept)
+			lazy_sweep(page, context);
+		if(page->free || (page->bump < page->n_cells))
+			break;
+		heap->avail[kind] = page->next_avail;
+	}
+
+	if(!page && (page = new_page(kind, heap)) == NULL) {
+		fprintf(stderr, "ERROR: Could not allocate new memory page.\n");
+		return NULL;
+	}
+
+	if(page->bump < page->n_cells) {
+		i = page->bump++;
+		cell = page->cells + i * page->cell_size;
+	} else {
+		cell = page->free;
+		page->free = page->free->next;
+		i = cell_index(cell, page);
+	}
+
+	set_bit(page->alloc_bits, i);
+	if(heap->phase == gc_phase_sweeping)
+		set_bit(page->mark_bits, i);
+	else
+		clear_bit(page->mark_bits, i);
+	page->n_used++;
+
+	if(!page->young) {
+		page->young = 1;
+		page->next_young = heap->young;
+		heap->young = page;
+	}
+	heap->young_bytes += page->cell_size;
+	heap->safepoint_bytes += page->cell_size;
+
+	context->mem_allocated += page->cell_size;
+	if(context->mem_allocated > context->n_bytes_peak)
+		context->n_bytes_peak = context->mem_allocated;
+
+	return cell;
+}
+
+/* Only touches the page itself, so pages can be swept in parallel. */
+static void release_cell(void *memory, page_t *page) {
+	free_cell_t *cell = memory;
+	size_t i = cell_index(memory, page);
+
+	clear_bit(page->alloc_bits, i);
+	clear_bit(page->mark_bits, i);
+	clear_bit(page->remembered_bits, i);
+	page->n_used--;
+
+	cell->next = page->free;
+	page->free = cell;
+}
+
+static void free_cell(void *memory, page_t *page, lisp_ctx_t *context) {
+	release_cell(memory, page);
+	context->mem_allocated -= page->cell_size;
+}
+
+static void free_string(char *text, lisp_heap_t *heap);
+
+/* Returns the bytes of the slots freed along with a frame, which the caller
+ * takes off mem_allocated and slot_bytes. */
+static size_t free_contents(lisp_data_t *in) {
+	if((in->type == lisp_type_frame) && (in->length > LISP_INLINE_SLOTS)) {
+		free_string((char*)in->frame.slots, page_of(in)->heap);
+		return in->length * sizeof(lisp_data_t*);
+	}
+	if((in->type != lisp_type_string) && (in->type != lisp_type_symbol) && (in->type != lisp_type_error))
+		return 0;
+	if(in->length > LISP_INLINE_TEXT)
+		free_string(in->text, page_of(in)->heap);
+	return 0;
+}
+
+static void uncount_slots(const size_t bytes, lisp_ctx_t *context) {
+	context->heap->slot_bytes -= bytes;
+	context->mem_allocated -= bytes;
+}
+
+/* Frees all unmarked cells of a page and adds the bytes of their slots to
+ * *slot_bytes. Returns the number of cells freed. */
+static size_t release_dead(page_t *page, size_t *slot_bytes) {
+	lisp_data_t *d;
+	uint32_t dead;
+	size_t word, bit, out = 0;
+
+	for(word = 0; word * 32 < page->bump; word++) {
+		dead = page->alloc_bits[word] & ~page->mark_bits[word];
+		for(bit = 0; dead; bit++, dead >>= 1) {
+			if(!(dead & 1))
+				continue;
+			d = (lisp_data_t*)(page->cells + (word * 32 + bit) * page->cell_size);
+			if(page->kind == cell_kind_data)
+				*slot_bytes += free_contents(d);
+			release_cell(d, page);
+			out++;
+		}
+	}
+
+	return out;
+}
+
+/* The bytes of the dead cells were already taken off mem_allocated when the
+ * page was flagged, those of their slots were not. */
+static void lazy_sweep(page_t *page, lisp_ctx_t *context) {
+	size_t slot_bytes = 0, n = release_dead(page, &slot_bytes);
+
+	uncount_slots(slot_bytes, context);
+
+	if(page->kind == cell_kind_data) {
+		context->mem_list_entries -= n;
+		context->n_frees += n;
+	}
+	page->unswept = 0;
+}
+
+static void complete_sweep(lisp_ctx_t *context) {
+	page_t *page;
+	int kind;
+
+	for(kind = 0; kind < n_cell_kinds; kind++)
+		for(page = context->heap->pages[kind]; page; page = page->next)
+			if(page->unswept)
+				lazy_sweep(page, context);
+}
+
+/* Is the calling thread the one running lisp_eval_thread()? */
+static int in_evaluation(lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+
+	return heap && heap->stack_base && same_thread(heap->stack_thread, current_thread());
+}
+
+/* Past the hard limit, an evaluation gets one full collection to make room.
+ * Unless that frees a sixteenth of the limit, so that an evaluation living
+ * right at the limit doesn't collect on every allocation, it is abandoned:
+ * lisp_eval_thread() returns an error instead. Anywhere else the allocation
+ * just fails. */
+static int check_limits(const size_t size, lisp_ctx_t *context) {
+	size_t newsize = context->mem_allocated + size;
+
+	if(newsize > context->mem_lim_hard) {
+		if(!context->eval_unwind || !in_evaluation(context))
+			return 0;
+
+		lisp_gc(LISP_GC_FORCE, context);
+		if(context->mem_allocated + size + context->mem_lim_hard / 16 > context->mem_lim_hard)
+			longjmp(*context->eval_unwind, 1);
+	} else if(!(context->warned) && (newsize > context->mem_lim_soft)) {
+		if(context->mem_verbosity == LISP_GC_VERBOSE)
+			fprintf(stderr, "-- WARNING: Soft memory limit reached.\n");
+		context->warned = 1;
+	} else if((context->warned) && (newsize < context->mem_lim_soft))
+		context->warned = 0;
+
+	return 1;
+}
+
+/* PROFILER */
+
+static size_t hash_sample(const char *file, const int line, const char *proc) {
+	size_t hash = (size_t)(uintptr_t)file ^ ((size_t)line * 31);
+
+	while(*proc)
+		hash = hash * 33 + (unsigned char)*proc++;
+
+	return hash % SAMPLE_BUCKETS;
+}
+
+static sample_t *find_sample(const char *file, const int line, const char *proc, lisp_heap_t *heap) {
+	size_t bucket = hash_sample(file, line, proc);
+	sample_t *sample;
+
+	for(sample = heap->samples[bucket]; sample; sample = sample->next)
+		if((sample->file == file) && (sample->line == line) && !strcmp(sample->proc, proc))
+			return sample;
+
+	if((sample = malloc(sizeof(sample_t))) == NULL)
+		return NULL;
+	if((sample->proc = malloc(strlen(proc) + 1)) == NULL) {
+		free(sample);
+		return NULL;
+	}
+
+	strcpy(sample->proc, proc);
+	sample->file = file;
+	sample->line = line;
+	sample->bytes = 0;
+	sample->objects = 0;
+	sample->next = heap->samples[bucket];
+	heap->samples[bucket] = sample;
+	heap->n_samples++;
+
+	return sample;
+}
+
+static void sample_alloc(const size_t size, const char *file, const int line, lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	size_t weight = context->alloc_sample_bytes;
+	sample_t *sample;
+
+	if(heap->sample_left > weight)
+		heap->sample_left = weight;
+	if(heap->sample_left > size) {
+		heap->sample_left -= size;
+		return;
+	}
+	heap->sample_left = weight;
+
+	if(weight < size)
+		weight = size;
+	if((sample = find_sample(file, line, context->eval_proc ? context->eval_proc : "", heap))) {
+		sample->bytes += weight;
+		sample->objects += weight / size;
+	}
+}
+
+static int compare_samples(const void *a, const void *b) {
+	const sample_t *sa = *(const sample_t**)a, *sb = *(const sample_t**)b;
+
+	if(sa->bytes != sb->bytes)
+		return (sa->bytes < sb->bytes) ? 1 : -1;
+	return 0;
+}
+
+/* Returns the samples sorted by bytes, or NULL if there are none. */
+static sample_t **sorted_samples(lisp_heap_t *heap, size_t *n) {
+	sample_t **out, *sample;
+	size_t i;
+
+	*n = 0;
+	if(!heap || !heap->n_samples)
+		return NULL;
+	if((out = malloc(heap->n_samples * sizeof(sample_t*))) == NULL)
+		return NULL;
+
+	for(i = 0; i < SAMPLE_BUCKETS; i++)
+		for(sample = heap->samples[i]; sample; sample = sample->next)
+			out[(*n)++] = sample;
+	qsort(out, *n, sizeof(sample_t*), compare_samples);
+
+	return out;
+}
+
+/* Only the evaluating thread itself may collect while an evaluation runs. */
+static int at_safepoint(lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+
+	if(!in_evaluation(context))
+		return 0;
+
+	/* A running cycle takes a slice for every page allocated, so that it
+	 * keeps up with the evaluation. */
+	if(heap->phase != gc_phase_idle) {
+		if(heap->safepoint_bytes < LISP_PAGE_SIZE)
+			return 0;
+	} else if((heap->safepoint_bytes < SAFEPOINT_BYTES) || (context->mem_allocated <= context->mem_lim_soft))
+		return 0;
+
+	heap->safepoint_bytes = 0;
+	return 1;
+}
+
+lisp_data_t *lisp_dalloc(const size_t size, const char *file, const int line, lisp_ctx_t *context) {
+	lisp_data_t *memory;
+#ifdef LISP_MEM_DEBUG
+	page_t *page;
+	size_t i;
+#endif
+
+	if(size > cell_sizes[cell_kind_data]) {
+		fprintf(stderr, "ERROR: Cannot allocate %zu bytes from the data heap.\n", size);
+		return NULL;
+	}
+
+	if(at_safepoint(context))
+		lisp_gc(LISP_GC_LOWMEM, context);
+
+	if(!check_limits(cell_sizes[cell_kind_data], context))
+		return NULL;
+
+	if(context->heap && context->heap->arena && in_evaluation(context))
+		memory = arena_alloc(context);
+	else
+		memory = alloc_cell(cell_kind_data, context);
+	if(memory == NULL)
+		return NULL;
+
+#ifdef LISP_MEM_DEBUG
+	page = page_of(memory);
+	i = cell_index(memory, page);
+	page->file[i] = file;
+	page->line[i] = line;
+#endif
+
+	if(context->alloc_sample_bytes)
+		sample_alloc(cell_sizes[cell_kind_data], file, line, context);
+
+	context->mem_list_entries++;
+	context->n_allocs++;
+
+	return memory;
+}
+
+/* WRITE BARRIER */
+
+static int set_mark(const void *memory);
+static void push_mark(lisp_data_t *d, lisp_heap_t *heap);
+
+static int is_old(const lisp_data_t *d) {
+	page_t *page = page_of(d);
+	return get_bit(page->mark_bits, cell_index(d, page)) != 0;
+}
+
+static void record_escape(const lisp_data_t *obj, arena_t *arena);
+
+/* Must be called whenever val is stored into the already existing object obj.
+ * Remembers obj if it is old and val is young, and if it is outside of the
+ * scratch arena and val inside. */
+void lisp_write_barrier(const lisp_data_t *obj, const lisp_data_t *val) {
+	page_t *page;
+	lisp_heap_t *heap;
+	lisp_data_t **remembered;
+	size_t i, size;
+
+	if(!obj || !is_heap(val))
+		return;
+
+	page = page_of(obj);
+	i = cell_index(obj, page);
+	heap = page->heap;
+
+	if(page->arena)
+		return;
+	if(heap->arena && page_of(val)->arena)
+		record_escape(obj, heap->arena);
+
+	/* The mark about to start traces everything anyway. */
+	if(heap->phase == gc_phase_clearing)
+		return;
+
+	if(heap->phase == gc_phase_marking) {
+		if(get_bit(page->mark_bits, i) && set_mark(val))
+			push_mark((lisp_data_t*)val, heap);
+		return;
+	}
+
+	if(!get_bit(page->mark_bits, i) || get_bit(page->remembered_bits, i) || is_old(val))
+		return;
+
+	if(heap->remembered_top == heap->remembered_size) {
+		size = heap->remembered_size ? 2 * heap->remembered_size : 256;
+		if((remembered = realloc(heap->remembered, size * sizeof(lisp_data_t*))) == NULL) {
+			/* Unmarking obj makes it young again, so it gets traced anyway. */
+			clear_bit(page->mark_bits, i);
+			return;
+		}
+		heap->remembered = remembered;
+		heap->remembered_size = size;
+	}
+
+	set_bit(page->remembered_bits, i);
+	heap->remembered[heap->remembered_top++] = (lisp_data_t*)obj;
+}
+
+/* SYMBOLS */
+
+static size_t hash_text(const char *text, const size_t length) {
+	size_t i, out = 2166136261u;
+
+	for(i = 0; i < length; i++)
+		out = (out ^ (unsigned char)text[i]) * 16777619u;
+	return out;
+}
+
+static int has_name(const lisp_data_t *symbol, const char *name, const size_t length) {
+	return (symbol->length == length) && !memcmp(lisp_text(symbol), name, length);
+}
+
+/* Returns the slot of the symbol called name, or the first free or dead slot
+ * on its probe sequence if there is none. */
+static lisp_data_t **find_slot(const char *name, const size_t length, lisp_heap_t *heap) {
+	size_t i = hash_text(name, length) & (heap->symbols_size - 1);
+	lisp_data_t **dead = NULL, *d;
+
+	while((d = heap->symbols[i]) != NULL) {
+		if(d == DEAD_SYMBOL) {
+			if(!dead)
+				dead = &heap->symbols[i];
+		} else if(has_name(d, name, length)) {
+			return &heap->symbols[i];
+		}
+		i = (i + 1) & (heap->symbols_size - 1);
+	}
+
+	return dead ? dead : &heap->symbols[i];
+}
+
+/* Rehashes into a table that is at most a quarter full, which also gets rid
+ * of the dead slots. */
+static int resize_symbols(lisp_heap_t *heap) {
+	lisp_data_t **old = heap->symbols, *d;
+	size_t i, old_size = heap->symbols_size, size = MIN_SYMBOLS;
+
+	while(size < 4 * (heap->n_symbols + 1))
+		size *= 2;
+	if((heap->symbols = calloc(size, sizeof(lisp_data_t*))) == NULL) {
+		heap->symbols = old;
+		return 0;
+	}
+	heap->symbols_size = size;
+	heap->n_dead_symbols = 0;
+
+	for(i = 0; i < old_size; i++)
+		if(((d = old[i]) != NULL) && (d != DEAD_SYMBOL))
+			*find_slot(lisp_text(d), d->length, heap) = d;
+	free(old);
+
+	return 1;
+}
+
+static void drop_symbol(lisp_data_t **slot, lisp_heap_t *heap) {
+	*slot = DEAD_SYMBOL;
+	heap->n_symbols--;
+	heap->n_dead_symbols++;
+}
+
+lisp_data_t *lisp_find_symbol(const char *name, const size_t length, lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	lisp_data_t **slot, *out;
+
+	if(!heap || !heap->n_symbols)
+		return NULL;
+
+	slot = find_slot(name, length, heap);
+	if(((out = *slot) == NULL) || (out == DEAD_SYMBOL))
+		return NULL;
+
+	/* An unmarked symbol found while sweeping is dead, its cell just has
+	 * not been swept yet. */
+	if((heap->phase == gc_phase_sweeping) && !is_old(out)) {
+		drop_symbol(slot, heap);
+		return NULL;
+	}
+
+	return out;
+}
+
+/* Interns a new symbol. Returns 0 if the table could not grow. */
+int lisp_add_symbol(lisp_data_t *symbol, lisp_ctx_t *context) {
+	lisp_heap_t *heap = get_heap(context);
+	lisp_data_t **slot;
+
+	if(!heap)
+		return 0;
+	if((4 * (heap->n_symbols + heap->n_dead_symbols + 1) > 3 * heap->symbols_size) && !resize_symbols(heap))
+		return 0;
+
+	slot = find_slot(lisp_text(symbol), symbol->length, heap);
+	if(*slot == DEAD_SYMBOL)
+		heap->n_dead_symbols--;
+	*slot = symbol;
+	heap->n_symbols++;
+
+	return 1;
+}
+
+/* Drops the symbols whose mark bit equals req_mark, like sweep_page() frees
+ * the cells. */
+static void purge_symbols(const int req_mark, lisp_heap_t *heap) {
+	lisp_data_t *d;
+	page_t *page;
+	size_t i;
+
+	for(i = 0; i < heap->symbols_size; i++) {
+		if(((d = heap->symbols[i]) == NULL) || (d == DEAD_SYMBOL))
+			continue;
+		page = page_of(d);
+		if(!get_bit(page->mark_bits, cell_index(d, page)) == !req_mark)
+			drop_symbol(&heap->symbols[i], heap);
+	}
+}
+
+/* Follows the forwarding addresses of moved symbols. The others are dropped
+ * if they are in pages about to be freed: all pages when copying, only the
+ * arena pages otherwise. */
+static void forward_symbols(const int arena, lisp_heap_t *heap) {
+	lisp_data_t *d;
+	page_t *page;
+	size_t i;
+
+	for(i = 0; i < heap->symbols_size; i++) {
+		if(((d = heap->symbols[i]) == NULL) || (d == DEAD_SYMBOL))
+			continue;
+		page = page_of(d);
+		if(arena && !page->arena)
+			continue;
+		if(get_bit(page->remembered_bits, cell_index(d, page)))
+			heap->symbols[i] = (lisp_data_t*)((free_cell_t*)d)->next;
+		else
+			drop_symbol(&heap->symbols[i], heap);
+	}
+}
+
+static void unintern(lisp_data_t *symbol, lisp_heap_t *heap) {
+	lisp_data_t **slot;
+
+	if(!heap->n_symbols)
+		return;
+	if(*(slot = find_slot(lisp_text(symbol), symbol->length, heap)) == symbol)
+		drop_symbol(slot, heap);
+}
+
+/* GARBAGE COLLECTOR */
+
+static void free_object(lisp_data_t *in, page_t *page, lisp_ctx_t *context) {
+	/* An incremental cycle leaves dead symbols in the table until now. */
+	if((in->type == lisp_type_symbol) && (page->heap->phase == gc_phase_sweeping))
+		unintern(in, page->heap);
+	uncount_slots(free_contents(in), context);
+
+	free_cell(in, page, context);
+	context->mem_list_entries--;
+	context->n_frees++;
+}
+
+void lisp_free_data(lisp_data_t *in, lisp_ctx_t *context) {
+	page_t *page;
+
+	if(!is_heap(in))
+		return;
+
+	page = context->heap ? find_page(in, context->heap) : NULL;
+	if(page && (page->kind == cell_kind_data) && get_bit(page->alloc_bits, cell_index(in, page))
+		&& !(page->unswept && !is_old(in))) {
+		if(in->type == lisp_type_symbol)
+			unintern(in, context->heap);
+		free_object(in, page, context);
+	} else {
+		fprintf(stderr, "-- WARNING: Called free() on unknown pointer.\n");
+	}
+}
+
+static void clear_mark(lisp_heap_t *heap) {
+	page_t *page;
+	int kind;
+
+	for(kind = 0; kind < n_cell_kinds; kind++) {
+		for(page = heap->pages[kind]; page; page = page->next) {
+			memset(page->mark_bits, 0, sizeof(page->mark_bits));
+			memset(page->remembered_bits, 0, sizeof(page->remembered_bits));
+		}
+	}
+	heap->remembered_top = 0;
+}
+
+/* Marking is driven by an explicit stack: a pair's car is pushed and its
+ * cdr is followed in the loop, so long lists take no stack at all. Frames
+ * and global references push all of their fields at once. If the stack
+ * cannot grow any further, the object is left marked but unscanned and
+ * rescan_overflow() picks it up again from the heap. */
+
+static int set_mark(const void *memory) {
+	page_t *page = page_of(memory);
+	size_t i = cell_index(memory, page);
+
+	if(get_bit(page->mark_bits, i))
+		return 0;
+	set_bit(page->mark_bits, i);
+	return 1;
+}
+
+static void push_mark(lisp_data_t *d, lisp_heap_t *heap) {
+	lisp_data_t **stack;
+	size_t size;
+
+	if(heap->mark_stack_top == heap->mark_stack_size) {
+		size = heap->mark_stack_size ? 2 * heap->mark_stack_size : 1024;
+		if((stack = realloc(heap->mark_stack, size * sizeof(lisp_data_t*))) == NULL) {
+			heap->mark_overflow = 1;
+			return;
+		}
+		heap->mark_stack = stack;
+		heap->mark_stack_size = size;
+	}
+
+	heap->mark_stack[heap->mark_stack_top++] = d;
+}
+
+static uint64_t now_us(void) {
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64_t)(count.QuadPart * 1000000 / freq.QuadPart);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static void scan_field(lisp_data_t *d, lisp_heap_t *heap) {
+	if(is_heap(d) && set_mark(d))
+		push_mark(d, heap);
+}
+
+static void scan_fields(lisp_data_t *d, lisp_heap_t *heap) {
+	lisp_data_t **slots;
+	unsigned int i;
+
+	if(d->type == lisp_type_lexical) {
+		scan_field(d->lexical.symbol, heap);
+		return;
+	}
+	if(d->type == lisp_type_global) {
+		scan_field(d->global.symbol, heap);
+		scan_field(d->global.cell, heap);
+		return;
+	}
+	if(d->type == lisp_type_closure) {
+		scan_field(d->closure.lambda, heap);
+		scan_field(d->closure.env, heap);
+		return;
+	}
+	if(d->type == lisp_type_node) {
+		scan_field(d->node.a, heap);
+		scan_field(d->node.b, heap);
+		return;
+	}
+
+	scan_field(d->frame.vars, heap);
+	for(slots = lisp_frame_slots(d), i = 0; i < d->length; i++)
+		scan_field(slots[i], heap);
+}
+
+/* Returns 0 if the deadline passed before the stack was empty. A deadline
+ * of 0 means no limit. */
+static int drain_mark_stack(lisp_heap_t *heap, const uint64_t deadline) {
+	lisp_data_t *d, *head;
+	size_t work = 0;
+
+	while(heap->mark_stack_top) {
+		if(deadline && (++work % SLICE_CHECK == 0) && (now_us() >= deadline))
+			return 0;
+
+		d = heap->mark_stack[--heap->mark_stack_top];
+		if(!get_bit(page_of(d)->alloc_bits, cell_index(d, page_of(d))))
+			continue;
+		if(has_fields(d))
+			scan_fields(d, heap);
+
+		while(d && (d->type == lisp_type_pair)) {
+			if(deadline && (++work % SLICE_CHECK == 0) && (now_us() >= deadline)) {
+				push_mark(d, heap);
+				return 0;
+			}
+
+			head = d->pair.l;
+			if(is_heap(head) && set_mark(head))
+				push_mark(head, heap);
+
+			d = d->pair.r;
+			if(!is_heap(d) || !set_mark(d))
+				break;
+			if(has_fields(d))
+				scan_fields(d, heap);
+		}
+	}
+
+	return 1;
+}
+
+static int is_unscanned(const lisp_data_t *d) {
+	return is_heap(d) && !is_old(d);
+}
+
+static int has_unscanned_fields(const lisp_data_t *d) {
+	lisp_data_t * const *slots;
+	unsigned int i;
+
+	if(d->type == lisp_type_pair)
+		return is_unscanned(d->pair.l) || is_unscanned(d->pair.r);
+	if(d->type == lisp_type_lexical)
+		return is_unscanned(d->lexical.symbol);
+	if(d->type == lisp_type_global)
+		return is_unscanned(d->global.symbol) || is_unscanned(d->global.cell);
+	if(d->type == lisp_type_closure)
+		return is_unscanned(d->closure.lambda) || is_unscanned(d->closure.env);
+	if(d->type == lisp_type_node)
+		return is_unscanned(d->node.a) || is_unscanned(d->node.b);
+	if(d->type != lisp_type_frame)
+		return 0;
+
+	if(is_unscanned(d->frame.vars))
+		return 1;
+	for(slots = lisp_frame_slots(d), i = 0; i < d->length; i++)
+		if(is_unscanned(slots[i]))
+			return 1;
+	return 0;
+}
+
+static void rescan_overflow(lisp_heap_t *heap) {
+	page_t *page;
+	lisp_data_t *d;
+	size_t i;
+
+	while(heap->mark_overflow) {
+		heap->mark_overflow = 0;
+
+		for(page = heap->pages[cell_kind_data]; page; page = page->next) {
+			for(i = 0; i < page->bump; i++) {
+				if(!get_bit(page->mark_bits, i) || !get_bit(page->alloc_bits, i))
+					continue;
+				d = (lisp_data_t*)(page->cells + i * page->cell_size);
+				if(has_unscanned_fields(d)) {
+					push_mark(d, heap);
+					drain_mark_stack(heap, 0);
+				}
+			}
+		}
+	}
+}
+
+/* Returns the cell that memory points into, if it is allocated and alive. */
+static lisp_data_t *find_cell(const void *memory, lisp_heap_t *heap) {
+	page_t *page = find_page(memory, heap);
+	size_t i;
+
+	if(!page || ((char*)memory < page->cells))
+		return NULL;
+
+	i = cell_index(memory, page);
+	if((i >= page->bump) || !get_bit(page->alloc_bits, i))
+		return NULL;
+	if(page->unswept && !get_bit(page->mark_bits, i))
+		return NULL;
+
+	return (lisp_data_t*)(page->cells + i * page->cell_size);
+}
+
+/* Scans from the registers, which setjmp() spills into the current frame,
+ * up to and including the word at stack_base. */
+NO_SANITIZE_ADDRESS static void scan_stack(lisp_heap_t *heap) {
+	jmp_buf regs;
+	void * volatile *from, * volatile *to, * volatile *buf;
+	lisp_data_t *d;
+
+	if(!heap->stack_base || !same_thread(heap->stack_thread, current_thread()))
+		return;
+
+	setjmp(regs);
+	from = (void**)((uintptr_t)&regs & ~(uintptr_t)(sizeof(void*) - 1));
+	to = heap->stack_base;
+	if(from > to) {
+		buf = from;
+		from = to;
+		to = buf;
+	}
+
+	for(; from <= to; from++) {
+		if(lisp_is_immediate(*from))
+			continue;
+		if((d = find_cell(*from, heap)) && set_mark(d))
+			push_mark(d, heap);
+	}
+}
+
+/* Marks the roots and pushes them for scanning. */
+static void push_roots(lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+
+	if(context->the_global_environment && set_mark(context->the_global_environment))
+		push_mark(context->the_global_environment, heap);
+	scan_stack(heap);
+}
+
+static void mark(lisp_data_t *start, lisp_heap_t *heap) {
+	if(is_heap(start) && set_mark(start))
+		push_mark(start, heap);
+
+	drain_mark_stack(heap, 0);
+	rescan_overflow(heap);
+}
+
+static void sweep_page(page_t *page, const int req_mark, lisp_ctx_t *context) {
+	uint32_t dead;
+	size_t word, bit;
+
+	for(word = 0; word * 32 < page->bump; word++) {
+		dead = page->alloc_bits[word] & (req_mark ? page->mark_bits[word] : ~page->mark_bits[word]);
+		for(bit = 0; dead; bit++, dead >>= 1)
+			if(dead & 1)
+				free_object((lisp_data_t*)(page->cells + (word * 32 + bit) * page->cell_size), page, context);
+	}
+}
+
+static size_t count_bits(uint32_t word) {
+	size_t out = 0;
+
+	for(; word; word &= word - 1)
+		out++;
+	return out;
+}
+
+/* Counts the marked cells of a page and adds their size to *bytes. */
+static size_t marked_cells(page_t *page, size_t *bytes) {
+	size_t word, out = 0;
+
+	for(word = 0; word * 32 < page->bump; word++)
+		out += count_bits(page->alloc_bits[word] & page->mark_bits[word]);
+	*bytes += out * page->cell_size;
+
+	return out;
+}
+
+static size_t marked_bytes(lisp_heap_t *heap, size_t *objects) {
+	page_t *page;
+	size_t out = 0;
+	int kind;
+
+	*objects = 0;
+	for(kind = 0; kind < n_cell_kinds; kind++)
+		for(page = heap->pages[kind]; page; page = page->next)
+			*objects += marked_cells(page, &out);
+
+	return out;
+}
+
+/* Publishes the counts of a finished collection to context->gc_info. */
+static void finish_cycle(const int full, lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	lisp_gc_info_t *info = &context->gc_info;
+
+	info->n_collections++;
+	if(full)
+		info->n_full_collections++;
+	info->objects_marked = heap->cycle.objects_marked;
+	info->bytes_marked = heap->cycle.bytes_marked;
+	info->objects_swept = heap->cycle.objects_swept;
+	info->bytes_swept = heap->cycle.bytes_swept;
+	info->heap_bytes = context->mem_allocated;
+	info->heap_reserved = heap->n_pages * LISP_PAGE_SIZE;
+
+	memset(&heap->cycle, 0, sizeof(gc_cycle_t));
+}
+
+/* Old objects keep their mark bits, so tracing stops at them. The roots of
+ * a minor collection are the global environment, the evaluation stack and
+ * the remembered set. */
+static void minor_gc(lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	lisp_data_t *obj;
+	page_t *page;
+	size_t i, n, old_objects = 0, old_bytes = 0, live_objects = 0, live_bytes = 0;
+	size_t old_frees = context->n_frees, old_mem = context->mem_allocated;
+
+	for(page = heap->young; page; page = page->next_young)
+		old_objects += marked_cells(page, &old_bytes);
+
+	push_roots(context);
+
+	for(n = 0; n < heap->remembered_top; n++) {
+		obj = heap->remembered[n];
+		page = page_of(obj);
+		i = cell_index(obj, page);
+		if(get_bit(page->remembered_bits, i) && get_bit(page->alloc_bits, i)) {
+			clear_bit(page->remembered_bits, i);
+			push_mark(obj, heap);
+		}
+	}
+	heap->remembered_top = 0;
+
+	mark(NULL, heap);
+	purge_symbols(0, heap);
+
+	for(page = heap->young; page; page = page->next_young) {
+		live_objects += marked_cells(page, &live_bytes);
+		if(page->kind == cell_kind_data)
+			sweep_page(page, 0, context);
+	}
+
+	heap->cycle.objects_marked = live_objects - old_objects;
+	heap->cycle.bytes_marked = live_bytes - old_bytes;
+	heap->cycle.objects_swept = context->n_frees - old_frees;
+	heap->cycle.bytes_swept = old_mem - context->mem_allocated;
+	finish_cycle(0, context);
+
+	rebuild_page_lists(heap);
+}
+
+/* PARALLEL COLLECTOR */
+
+typedef struct gc_team_t gc_team_t;
+
+typedef struct gc_worker_t {
+	lisp_data_t **items;
+	size_t size;
+	size_t head;
+	size_t tail;
+	gc_lock_t lock;
+
+	size_t freed_bytes;
+	size_t freed_slots;
+	size_t freed_objects;
+	gc_team_t *team;
+} gc_worker_t;
+
+struct gc_team_t {
+	gc_worker_t *workers;
+	long n_workers;
+	volatile long idle;
+	volatile long overflow;
+
+	page_t **pages;
+	long n_pages;
+	volatile long next_page;
+};
+
+static int atomic_set_mark(const void *memory) {
+	page_t *page = page_of(memory);
+	size_t i = cell_index(memory, page);
+	uint32_t bit = 1u << (i & 31);
+
+	if(atomic_get(&page->mark_bits[i >> 5]) & bit)
+		return 0;
+	return !(atomic_or(&page->mark_bits[i >> 5], bit) & bit);
+}
+
+static void deque_push(lisp_data_t *d, gc_worker_t *worker) {
+	lisp_data_t **items;
+	size_t size;
+
+	lock(&worker->lock);
+	if(worker->tail == worker->size) {
+		if(worker->head) {
+			memmove(worker->items, worker->items + worker->head, (worker->tail - worker->head) * sizeof(lisp_data_t*));
+			worker->tail -= worker->head;
+			worker->head = 0;
+		} else {
+			size = worker->size ? 2 * worker->size : 1024;
+			if((items = realloc(worker->items, size * sizeof(lisp_data_t*))) == NULL) {
+				unlock(&worker->lock);
+				worker->team->overflow = 1;
+				return;
+			}
+			worker->items = items;
+			worker->size = size;
+		}
+	}
+	worker->items[worker->tail++] = d;
+	unlock(&worker->lock);
+}
+
+/* The owner pops from the tail, thieves take from the head. */
+static lisp_data_t *deque_take(gc_worker_t *worker, const int steal) {
+	lisp_data_t *d = NULL;
+
+	lock(&worker->lock);
+	if(worker->tail > worker->head) {
+		d = steal ? worker->items[worker->head++] : worker->items[--worker->tail];
+		if(worker->head == worker->tail)
+			worker->head = worker->tail = 0;
+	}
+	unlock(&worker->lock);
+
+	return d;
+}
+
+static lisp_data_t *steal_work(gc_worker_t *worker) {
+	gc_team_t *team = worker->team;
+	long self = (long)(worker - team->workers), n;
+	lisp_data_t *d;
+
+	for(n = 1; n < team->n_workers; n++)
+		if((d = deque_take(&team->workers[(self + n) % team->n_workers], 1)))
+			return d;
+
+	return NULL;
+}
+
+static int has_work(gc_team_t *team) {
+	gc_worker_t *worker;
+	int out = 0;
+	long n;
+
+	for(n = 0; !out && (n < team->n_workers); n++) {
+		worker = &team->workers[n];
+		lock(&worker->lock);
+		out = worker->tail > worker->head;
+		unlock(&worker->lock);
+	}
+	return out;
+}
+
+static void share_field(lisp_data_t *d, gc_worker_t *worker) {
+	if(is_heap(d) && atomic_set_mark(d))
+		deque_push(d, worker);
+}
+
+static void share_fields(lisp_data_t *d, gc_worker_t *worker) {
+	lisp_data_t **slots;
+	unsigned int i;
+
+	if(d->type == lisp_type_lexical) {
+		share_field(d->lexical.symbol, worker);
+		return;
+	}
+	if(d->type == lisp_type_global) {
+		share_field(d->global.symbol, worker);
+		share_field(d->global.cell, worker);
+		return;
+	}
+	if(d->type == lisp_type_closure) {
+		share_field(d->closure.lambda, worker);
+		share_field(d->closure.env, worker);
+		return;
+	}
+	if(d->type == lisp_type_node) {
+		share_field(d->node.a, worker);
+		share_field(d->node.b, worker);
+		return;
+	}
+
+	share_field(d->frame.vars, worker);
+	for(slots = lisp_frame_slots(d), i = 0; i < d->length; i++)
+		share_field(slots[i], worker);
+}
+
+static void mark_worker(gc_worker_t *worker) {
+	gc_team_t *team = worker->team;
+	lisp_data_t *d, *head;
+
+	for(;;) {
+		if((d = deque_take(worker, 0)) || (d = steal_work(worker))) {
+			if(has_fields(d))
+				share_fields(d, worker);
+			while(d && (d->type == lisp_type_pair)) {
+				head = d->pair.l;
+				if(is_heap(head) && atomic_set_mark(head))
+					deque_push(head, worker);
+
+				d = d->pair.r;
+				if(!is_heap(d) || !atomic_set_mark(d))
+					break;
+				if(has_fields(d))
+					share_fields(d, worker);
+			}
+			continue;
+		}
+
+		/* Nobody pushes onto the deque of an idle worker, so once all of
+		 * them are idle, all deques are empty for good. */
+		atomic_add(&team->idle, 1);
+		for(;;) {
+			if(atomic_get(&team->idle) == team->n_workers)
+				return;
+			if(has_work(team)) {
+				atomic_add(&team->idle, -1);
+				break;
+			}
+			yield_thread();
+		}
+	}
+}
+
+static void sweep_worker(gc_worker_t *worker) {
+	gc_team_t *team = worker->team;
+	page_t *page;
+	size_t freed;
+	long n;
+
+	while((n = atomic_add(&team->next_page, 1)) < team->n_pages) {
+		page = team->pages[n];
+		freed = release_dead(page, &worker->freed_slots);
+		if(page->kind == cell_kind_data)
+			worker->freed_objects += freed;
+		worker->freed_bytes += freed * page->cell_size;
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_thread(LPVOID in) {
+#else
+static void *worker_thread(void *in) {
+#endif
+	gc_worker_t *worker = in;
+
+	if(worker->team->next_page < 0)
+		mark_worker(worker);
+	else
+		sweep_worker(worker);
+	return 0;
+}
+
+static void run_team(gc_team_t *team) {
+#ifdef _WIN32
+	HANDLE *threads = malloc(team->n_workers * sizeof(HANDLE));
+#else
+	pthread_t *threads = malloc(team->n_workers * sizeof(pthread_t));
+#endif
+	long n, started = 1;
+
+	if(threads) {
+		for(started = 1; started < team->n_workers; started++) {
+#ifdef _WIN32
+			if((threads[started] = CreateThread(NULL, 0, worker_thread, &team->workers[started], 0, NULL)) == NULL)
+				break;
+#else
+			if(pthread_create(&threads[started], NULL, worker_thread, &team->workers[started]))
+				break;
+#endif
+		}
+	}
+
+	/* Threads that could not be started are stood in for by this one. */
+	worker_thread(&team->workers[0]);
+	for(n = started; n < team->n_workers; n++)
+		worker_thread(&team->workers[n]);
+
+	for(n = 1; n < started; n++) {
+#ifdef _WIN32
+		WaitForSingleObject(threads[n], INFINITE);
+		CloseHandle(threads[n]);
+#else
+		pthread_join(threads[n], NULL);
+#endif
+	}
+	free(threads);
+}
+
+static int parallel_gc(const int sweep, lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	gc_team_t team;
+	page_t *page;
+	long n;
+	int kind;
+
+	memset(&team, 0, sizeof(team));
+	team.n_workers = (long)context->gc_threads;
+	team.pages = malloc(heap->n_pages * sizeof(page_t*));
+	if(!team.pages || (team.workers = calloc(team.n_workers, sizeof(gc_worker_t))) == NULL) {
+		free(team.pages);
+		return 0;
+	}
+
+	for(n = 0; n < team.n_workers; n++) {
+		team.workers[n].team = &team;
+		init_lock(&team.workers[n].lock);
+	}
+
+	clear_mark(heap);
+	push_roots(context);
+	while(heap->mark_stack_top)
+		deque_push(heap->mark_stack[--heap->mark_stack_top], &team.workers[0]);
+
+	team.next_page = -1;
+	run_team(&team);
+
+	if(team.overflow) {
+		heap->mark_overflow = 1;
+		rescan_overflow(heap);
+	}
+	purge_symbols(0, heap);
+
+	if(sweep) {
+		for(kind = 0; kind < n_cell_kinds; kind++)
+			for(page = heap->pages[kind]; page; page = page->next)
+				team.pages[team.n_pages++] = page;
 
-typedef struct alloclist_t {
-	lisp_data_t *memory;
-	char *file;
-	int line;
-	size_t size;
-	char mark;
-	struct alloclist_t *next;
-} alloclist_t;
+		team.next_page = 0;
+		run_team(&team);
+	}
 
-/* ALLOCATOR */
+	for(n = 0; n < team.n_workers; n++) {
+		context->mem_allocated -= team.workers[n].freed_bytes;
+		uncount_slots(team.workers[n].freed_slots, context);
+		context->mem_list_entries -= team.workers[n].freed_objects;
+		context->n_frees += team.workers[n].freed_objects;
+		destroy_lock(&team.workers[n].lock);
+		free(team.workers[n].items);
+	}
+	free(team.workers);
+	free(team.pages);
+
+	return 1;
+}
+
+/* COPYING COLLECTOR */
+
+typedef struct to_space_t {
+	page_t **pages;
+	size_t n_pages;
+	size_t fill;
+	size_t scan_page;
+	size_t scan_cell;
+} to_space_t;
 
-static alloclist_t *make_entry(lisp_data_t *memory, const char *file, const int line, const size_t size) {
-	alloclist_t *out;
-	
-	if((out = malloc(sizeof(alloclist_t))) == NULL)
-		return NULL;	
+static void *copy_cell(to_space_t *to) {
+	page_t *page = to->pages[to->fill];
+	size_t i;
 
-	out->memory = memory;
-	out->line = line;
-	out->file = (char*)file;	
-	out->mark = 0;
-	out->size = size;
-	out->next = NULL;
+	if(page->bump == page->n_cells)
+		page = to->pages[++to->fill];
+
+	i = page->bump++;
+	set_bit(page->alloc_bits, i);
+	set_bit(page->mark_bits, i);
+	page->n_used++;
+
+	return page->cells + i * page->cell_size;
+}
+
+static lisp_data_t *forward(lisp_data_t *d, to_space_t *to) {
+	page_t *page;
+	lisp_data_t *out;
+	size_t i;
+#ifdef LISP_MEM_DEBUG
+	page_t *out_page;
+	size_t j;
+#endif
+
+	if(!is_heap(d))
+		return d;
+
+	page = page_of(d);
+	i = cell_index(d, page);
+	if(get_bit(page->remembered_bits, i))
+		return (lisp_data_t*)((free_cell_t*)d)->next;
+
+	out = copy_cell(&to[cell_kind_data]);
+	*out = *d;
+#ifdef LISP_MEM_DEBUG
+	out_page = page_of(out);
+	j = cell_index(out, out_page);
+	out_page->file[j] = page->file[i];
+	out_page->line[j] = page->line[i];
+#endif
+
+	set_bit(page->remembered_bits, i);
+	((free_cell_t*)d)->next = (free_cell_t*)out;
 
 	return out;
 }
 
-static void addtolist(alloclist_t *entry, lisp_ctx_t *context) {
-	alloclist_t *current = context->alloc_list, *last = NULL;
-	if(!current) {
-		context->alloc_list = entry;
-		context->mem_list_entries++;		
-		return;
-	}
+static int reserve_to_space(to_space_t *to, const cell_kind_t kind, const size_t live, lisp_heap_t *heap) {
+	size_t n_cells = (LISP_PAGE_SIZE - PAGE_HEADER_SIZE) / cell_sizes[kind];
+
+	to->n_pages = live / n_cells + 1;
+	if((to->pages = calloc(to->n_pages, sizeof(page_t*))) == NULL)
+		return 0;
 
-	while(current && ((void*)current->memory < (void*)entry->memory)) {
-		last = current;		
-		current = current->next;
+	for(to->fill = 0; to->fill < to->n_pages; to->fill++) {
+		if((to->pages[to->fill] = new_page(kind, heap)) == NULL)
+			return 0;
 	}
+	to->fill = 0;
 
-	if(last)
-		last->next = entry;
-	else
-		context->alloc_list = entry;		
-	
-	entry->next = current;
+	return 1;
+}
 
-	context->mem_list_entries++;	
+static void release_to_space(to_space_t *to, lisp_heap_t *heap) {
+	size_t n;
+
+	for(n = 0; to->pages && (n < to->n_pages) && to->pages[n]; n++) {
+		remove_page(to->pages[n], heap);
+		free_page(to->pages[n]);
+	}
 }
 
-lisp_data_t *lisp_dalloc(const size_t size, const char *file, const int line, lisp_ctx_t *context) {
-	lisp_data_t *memory;
-	size_t newsize = context->mem_allocated + size;
-	alloclist_t *newentry;
+/* Expects all live objects to be marked. Returns 0 if there was not enough
+ * memory for the new pages, leaving the heap as it was. */
+static int evacuate(lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	page_t *from[n_cell_kinds], *page, *buf;
+	to_space_t to[n_cell_kinds];
+	size_t live[n_cell_kinds], word, bit, dead = 0, slot_bytes = 0;
+	uint32_t unmoved;
+	lisp_data_t *d, **slots;
+	unsigned int i;
+	int kind;
 
-	if(newsize > context->mem_lim_hard) {
-		if(context->thread_running)
-			for(;;);
-		return NULL;
-	} else if(!(context->warned) && (newsize > context->mem_lim_soft)) {
-		if(context->mem_verbosity == LISP_GC_VERBOSE)
-			fprintf(stderr, "-- WARNING: Soft memory limit reached.\n");
-		context->warned = 1;
-	} else if((context->warned) && (newsize < context->mem_lim_soft))
-		context->warned = 0;
+	memset(to, 0, sizeof(to));
+	for(kind = 0; kind < n_cell_kinds; kind++) {
+		live[kind] = 0;
+		for(page = heap->pages[kind]; page; page = page->next)
+			for(word = 0; word * 32 < page->bump; word++)
+				live[kind] += count_bits(page->alloc_bits[word] & page->mark_bits[word]);
 
-	memory = malloc(size);
+		from[kind] = heap->pages[kind];
+		heap->pages[kind] = NULL;
+		heap->avail[kind] = NULL;
+	}
 
-	if(memory) {
-		if((newentry = make_entry(memory, file, line, size))) {
-			addtolist(newentry, context);
+	for(kind = 0; kind < n_cell_kinds; kind++) {
+		if(!reserve_to_space(&to[kind], kind, live[kind], heap)) {
+			for(kind = 0; kind < n_cell_kinds; kind++) {
+				release_to_space(&to[kind], heap);
+				free(to[kind].pages);
+				heap->pages[kind] = from[kind];
+			}
+			return 0;
+		}
+	}
 
-			context->mem_allocated += size;
-			if(context->mem_allocated > context->n_bytes_peak)
-				context->n_bytes_peak = context->mem_allocated;
+	context->the_global_environment = forward(context->the_global_environment, to);
 
-			context->n_allocs++;
-		} else {
-			fprintf(stderr, "ERROR: malloc() failed for new memory list entry.\n");
-			free(memory);
-			return NULL;
+	for(;;) {
+		page = to[cell_kind_data].pages[to[cell_kind_data].scan_page];
+		if(to[cell_kind_data].scan_cell == page->bump) {
+			if(to[cell_kind_data].scan_page == to[cell_kind_data].fill)
+				break;
+			to[cell_kind_data].scan_page++;
+			to[cell_kind_data].scan_cell = 0;
+			continue;
+		}
+
+		d = (lisp_data_t*)(page->cells + to[cell_kind_data].scan_cell++ * page->cell_size);
+		if(d->type == lisp_type_pair) {
+			d->pair.r = forward(d->pair.r, to);
+			d->pair.l = forward(d->pair.l, to);
+		} else if(d->type == lisp_type_frame) {
+			d->frame.vars = forward(d->frame.vars, to);
+			for(slots = lisp_frame_slots(d), i = 0; i < d->length; i++)
+				slots[i] = forward(slots[i], to);
+		} else if(d->type == lisp_type_lexical) {
+			d->lexical.symbol = forward(d->lexical.symbol, to);
+		} else if(d->type == lisp_type_global) {
+			d->global.symbol = forward(d->global.symbol, to);
+			d->global.cell = forward(d->global.cell, to);
+		} else if(d->type == lisp_type_closure) {
+			d->closure.lambda = forward(d->closure.lambda, to);
+			d->closure.env = forward(d->closure.env, to);
+		} else if(d->type == lisp_type_node) {
+			d->node.a = forward(d->node.a, to);
+			d->node.b = forward(d->node.b, to);
 		}
 	}
-	return memory;
+	forward_symbols(0, heap);
+
+	for(kind = 0; kind < n_cell_kinds; kind++) {
+		for(page = from[kind]; page; page = buf) {
+			buf = page->next;
+			for(word = 0; (kind == cell_kind_data) && (word * 32 < page->bump); word++) {
+				unmoved = page->alloc_bits[word] & ~page->remembered_bits[word];
+				for(bit = 0; unmoved; bit++, unmoved >>= 1) {
+					if(unmoved & 1) {
+						slot_bytes += free_contents((lisp_data_t*)(page->cells + (word * 32 + bit) * page->cell_size));
+						dead++;
+					}
+				}
+			}
+			remove_page(page, heap);
+			free_page(page);
+		}
+		free(to[kind].pages);
+	}
+
+	heap->slot_bytes -= slot_bytes;
+	context->mem_allocated = live[cell_kind_data] * cell_sizes[cell_kind_data] + heap->slot_bytes;
+	context->mem_list_entries -= dead;
+	context->n_frees += dead;
+	context->n_moves++;
+
+	heap->young = NULL;
+	heap->young_bytes = 0;
+	heap->remembered_top = 0;
+
+	return 1;
 }
 
-/* GARBAGE COLLECTOR */
+static void defer_sweep(lisp_heap_t *heap) {
+	page_t *page;
+	size_t word;
+	int kind;
+
+	for(kind = 0; kind < n_cell_kinds; kind++) {
+		for(page = heap->pages[kind]; page; page = page->next) {
+			for(word = 0; word * 32 < page->bump; word++) {
+				if(page->alloc_bits[word] & ~page->mark_bits[word]) {
+					page->unswept = 1;
+					break;
+				}
+			}
+		}
+	}
+}
 
-static int delfromlist(const void *memory, lisp_ctx_t *context) {
-	alloclist_t *current = context->alloc_list, *last = NULL;
+static void major_gc(const int lazy, lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	int copy = context->gc_copying && !heap->stack_base;
+	size_t old_mem, old_objects, live, live_objects;
+	uint64_t start = now_us();
+	page_t *page;
 
-	if(!memory)
-		return 0;
+	complete_sweep(context);
+	old_mem = context->mem_allocated;
+	old_objects = context->mem_list_entries;
 
-	while(current) {
-		if((void*)current->memory < (void*)memory) {
-			 last = current;
-			 current = current->next;
-		} else {
-			if(last)
-				last->next = current->next;
-			else
-				context->alloc_list = current->next;
-
-			context->mem_allocated -= current->size;
-			context->mem_list_entries--;
-			free(current);
-			return 1;
-		}		
+	if((context->gc_threads < 2) || !parallel_gc(!lazy && !copy, context)) {
+		clear_mark(heap);
+		push_roots(context);
+		mark(NULL, heap);
+		purge_symbols(0, heap);
+
+		if(!lazy && !copy)
+			for(page = heap->pages[cell_kind_data]; page; page = page->next)
+				sweep_page(page, 0, context);
 	}
 
-	return 0;
+	if(copy && !evacuate(context)) {
+		copy = 0;
+		if(!lazy)
+			for(page = heap->pages[cell_kind_data]; page; page = page->next)
+				sweep_page(page, 0, context);
+	}
+
+	live = marked_bytes(heap, &live_objects);
+	if(lazy && !copy) {
+		defer_sweep(heap);
+		context->mem_allocated = live + heap->slot_bytes;
+	}
+
+	heap->bytes_marked += live;
+	heap->bytes_swept += old_mem - context->mem_allocated;
+	heap->full_gc_us += now_us() - start;
+	heap->n_full_gcs++;
+
+	heap->cycle.objects_marked = live_objects;
+	heap->cycle.bytes_marked = live;
+	heap->cycle.objects_swept = old_objects - live_objects;
+	heap->cycle.bytes_swept = old_mem - context->mem_allocated;
+	finish_cycle(1, context);
+
+	rebuild_page_lists(heap);
 }
 
-void lisp_free_data(lisp_data_t *in, lisp_ctx_t *context) {
-	if(!in)
+/* Sweeps the rest of any page left unswept and clears the mark bits, one
+ * page after the other. Returns 0 if the deadline passed before the last
+ * page. */
+static int clear_pages(const uint64_t deadline, lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	page_t *page;
+
+	while((page = heap->sweep_cursor) != NULL) {
+		if(page->unswept)
+			lazy_sweep(page, context);
+		memset(page->mark_bits, 0, sizeof(page->mark_bits));
+		memset(page->remembered_bits, 0, sizeof(page->remembered_bits));
+
+		heap->sweep_cursor = page->next;
+		if(now_us() >= deadline)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Like sweep_page(), but starts at *word and stops once the deadline has
+ * passed. Returns 0 if it did not get to the end of the page. */
+static int sweep_words(page_t *page, size_t *word, const uint64_t deadline, lisp_ctx_t *context) {
+	uint32_t dead;
+	size_t bit;
+
+	for(; *word * 32 < page->bump; (*word)++) {
+		if(*word && (*word % (SLICE_CHECK / 32) == 0) && (now_us() >= deadline))
+			return 0;
+
+		dead = page->alloc_bits[*word] & ~page->mark_bits[*word];
+		for(bit = 0; dead; bit++, dead >>= 1)
+			if(dead & 1)
+				free_object((lisp_data_t*)(page->cells + (*word * 32 + bit) * page->cell_size), page, context);
+	}
+
+	return 1;
+}
+
+/* Empty pages beyond the nursery are handed back to the system here, which
+ * may cost a system call each, so the deadline is checked for every page.
+ * A deadline of 0 frees them all. */
+static void free_spare_pages(const uint64_t deadline, lisp_heap_t *heap) {
+	page_t *page;
+
+	while((page = heap->spare_pages) && (!deadline || (now_us() < deadline))) {
+		heap->spare_pages = page->next;
+		free_page(page);
+	}
+}
+
+/* Runs one slice of an incremental full collection. */
+static void gc_slice(lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	uint64_t deadline = now_us() + context->gc_pause_budget_us;
+	size_t old_frees, old_mem;
+	page_t *page;
+
+	if(heap->phase == gc_phase_clearing) {
+		if(!clear_pages(deadline, context))
+			return;
+		heap->phase = gc_phase_marking;
+		push_roots(context);
+	}
+
+	if(heap->phase == gc_phase_marking) {
+		if(!drain_mark_stack(heap, deadline))
+			return;
+
+		/* Stores into the stack have no barrier, so it is scanned again
+		 * before the cycle may finish. If what it turns up cannot be
+		 * traced in time, the next slice drains and scans again. */
+		scan_stack(heap);
+		if(!drain_mark_stack(heap, deadline))
+			return;
+		rescan_overflow(heap);
+
+		heap->phase = gc_phase_sweeping;
+		heap->sweep_cursor = heap->pages[cell_kind_data];
+		heap->sweep_word = 0;
+	}
+
+	old_frees = context->n_frees;
+	old_mem = context->mem_allocated;
+	while((page = heap->sweep_cursor) != NULL) {
+		if(!heap->sweep_word)
+			heap->cycle.objects_marked += marked_cells(page, &heap->cycle.bytes_marked);
+		if(!sweep_words(page, &heap->sweep_word, deadline, context))
+			break;
+		heap->sweep_cursor = page->next;
+		heap->sweep_word = 0;
+	}
+	heap->cycle.objects_swept += context->n_frees - old_frees;
+	heap->cycle.bytes_swept += old_mem - context->mem_allocated;
+	if(heap->sweep_cursor)
 		return;
 
-	if(delfromlist(in, context)) {
-		if(in->type == lisp_type_string)
-			free(in->string);
-		if(in->type == lisp_type_symbol)
-			free(in->symbol);
-		if(in->type == lisp_type_error)
-			free(in->error);
-		if(in->type == lisp_type_pair)
-			free(in->pair);
-
-		free(in);
-		context->n_frees++;
+	heap->phase = gc_phase_idle;
+	finish_cycle(1, context);
+	rebuild_page_lists(heap);
+}
+
+/* The mark bits are cleared in slices as well, before the roots are pushed
+ * by the slice that is done with them. */
+static void start_cycle(lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+
+	heap->phase = gc_phase_clearing;
+	heap->sweep_cursor = heap->pages[cell_kind_data];
+	heap->remembered_top = 0;
+}
+
+static void abort_cycle(lisp_heap_t *heap) {
+	memset(&heap->cycle, 0, sizeof(gc_cycle_t));
+	heap->phase = gc_phase_idle;
+	heap->mark_stack_top = 0;
+	heap->sweep_cursor = NULL;
+	heap->sweep_word = 0;
+}
+
+/* Bucket 0 of the histogram counts pauses shorter than a microsecond, bucket
+ * i those from 2^(i-1) up to 2^i microseconds and the last one all longer
+ * pauses. */
+static void record_pause(const uint64_t us, lisp_ctx_t *context) {
+	lisp_gc_info_t *info = &context->gc_info;
+	size_t bucket = 0;
+
+	while((bucket < LISP_GC_PAUSE_BUCKETS - 1) && (us >> bucket))
+		bucket++;
+
+	info->n_pauses++;
+	info->pause_us_total += us;
+	if(us > info->pause_us_max)
+		info->pause_us_max = us;
+	info->pause_histogram[bucket]++;
+}
+
+size_t lisp_gc(const int force, lisp_ctx_t *context) {
+	size_t old_mem = context->mem_allocated;
+	uint64_t start = now_us();
+
+	if(!context->heap || context->heap->arena)
+		return 0;
+
+	if(force == LISP_GC_FORCE) {
+		abort_cycle(context->heap);
+		major_gc(0, context);
+	} else if(context->heap->phase != gc_phase_idle) {
+		gc_slice(context);
+	} else if(context->gc_pause_budget_us && !context->gc_copying) {
+		/* Minor collections cannot be split, so with a budget only the
+		 * cycles collect. */
+		if(context->mem_allocated > context->mem_lim_soft) {
+			start_cycle(context);
+			gc_slice(context);
+		}
 	} else {
-		fprintf(stderr, "-- WARNING: Called free() on unknown pointer.\n");
+		minor_gc(context);
+
+		if(context->mem_allocated > context->mem_lim_soft)
+			major_gc(1, context);
+	}
+
+	/* A cycle may leave hundreds of empty pages behind. */
+	if(context->gc_pause_budget_us && (force != LISP_GC_FORCE))
+		free_spare_pages(start + context->gc_pause_budget_us, context->heap);
+	else
+		free_spare_pages(0, context->heap);
+
+	record_pause(now_us() - start, context);
+
+	return old_mem - context->mem_allocated;
+}
+
+/* STACK */
+
+void lisp_gc_set_stack(const void *base, lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+
+	if(!heap)
+		return;
+
+	heap->stack_base = (void*)base;
+	heap->stack_thread = current_thread();
+	heap->safepoint_bytes = 0;
+}
+
+/* STRINGS */
+
+static size_t string_class(const size_t bytes) {
+	size_t size = sizeof(string_block_t) + bytes, class;
+
+	for(class = 0; class < STRING_CLASSES; class++)
+		if(size <= (size_t)MIN_STRING_SIZE << class)
+			break;
+
+	return class;
+}
+
+/* Takes a block from the current chunk. The first block of every chunk links
+ * it to the previous one. */
+static string_block_t *carve_string(const size_t size, lisp_heap_t *heap) {
+	string_block_t *out;
+	char *chunk;
+
+	if(heap->string_left < size) {
+		if((chunk = malloc(STRING_CHUNK)) == NULL)
+			return NULL;
+		*(char**)chunk = heap->string_chunks;
+		heap->string_chunks = chunk;
+		heap->string_bump = chunk + MIN_STRING_SIZE;
+		heap->string_left = STRING_CHUNK - MIN_STRING_SIZE;
+		heap->string_reserved += STRING_CHUNK;
 	}
+
+	out = (string_block_t*)heap->string_bump;
+	heap->string_bump += size;
+	heap->string_left -= size;
+
+	return out;
 }
 
-static void clear_mark(lisp_ctx_t *context) {
-	alloclist_t *current = context->alloc_list;
+/* Blocks remember how many bytes were asked for, which tells free_string()
+ * their class. */
+static char *alloc_block(const size_t bytes, lisp_heap_t *heap) {
+	string_block_t *block;
+	size_t class;
 
-	while(current) {
-		current->mark = 0;			
-		current = current->next;
+	if((class = string_class(bytes)) == STRING_CLASSES) {
+		block = malloc(sizeof(string_block_t) + bytes);
+	} else {
+		lock(&heap->string_lock);
+		if((block = heap->string_free[class]) != NULL)
+			heap->string_free[class] = block->next;
+		else
+			block = carve_string((size_t)MIN_STRING_SIZE << class, heap);
+		unlock(&heap->string_lock);
 	}
+
+	if(!block)
+		return NULL;
+
+	block->length = bytes;
+	return block->text;
+}
+
+/* Returns room for length characters and the terminating zero. The block is
+ * owned by the cell the text is stored in and freed along with it. */
+char *lisp_string_alloc(const size_t length, lisp_ctx_t *context) {
+	lisp_heap_t *heap = get_heap(context);
+	return heap ? alloc_block(length + 1, heap) : NULL;
 }
 
-static alloclist_t *find_in_list(const void *memory, lisp_ctx_t *context) {
-	alloclist_t *current =  context->alloc_list;
+/* Returns the slots of a frame too large to hold them in its cell. */
+lisp_data_t **lisp_slots_alloc(const size_t n, lisp_ctx_t *context) {
+	lisp_heap_t *heap = get_heap(context);
+	size_t bytes = n * sizeof(lisp_data_t*);
+	lisp_data_t **out;
 
-	if(!memory)
+	if(!heap || !check_limits(bytes, context))
+		return NULL;
+	if((out = (lisp_data_t**)alloc_block(bytes, heap)) == NULL)
 		return NULL;
 
-	while(current) {
-		if(current->memory == memory)
-			return current;
-		current = current->next;
-	}
+	heap->slot_bytes += bytes;
+	context->mem_allocated += bytes;
+	if(context->mem_allocated > context->n_bytes_peak)
+		context->n_bytes_peak = context->mem_allocated;
 
-	return NULL;
+	return out;
 }
 
-static void mark(lisp_data_t *start, lisp_ctx_t *context) {
-	alloclist_t *list_entry;
-	lisp_data_t *head, *tail;
+/* Sweeping threads free blocks concurrently, hence the lock. */
+static void free_string(char *text, lisp_heap_t *heap) {
+	string_block_t *block = (string_block_t*)(text - offsetof(string_block_t, text));
+	size_t class = string_class(block->length);
 
-	if(!start)
+	if(class == STRING_CLASSES) {
+		free(block);
 		return;
+	}
 
-	list_entry = find_in_list(start, context);
+	lock(&heap->string_lock);
+	block->next = heap->string_free[class];
+	heap->string_free[class] = block;
+	unlock(&heap->string_lock);
+}
 
-	if(!list_entry) {
-		fprintf(stderr, "ERROR: %p not found in memory list.\n", start);
-		return;
+/* Only for slots the frame has stopped using. */
+void lisp_slots_free(lisp_data_t **slots, lisp_ctx_t *context) {
+	uncount_slots(((string_block_t*)((char*)slots - offsetof(string_block_t, text)))->length, context);
+	free_string((char*)slots, context->heap);
+}
+
+static void free_strings(lisp_heap_t *heap) {
+	char *chunk;
+
+	while((chunk = heap->string_chunks) != NULL) {
+		heap->string_chunks = *(char**)chunk;
+		free(chunk);
 	}
+	destroy_lock(&heap->string_lock);
+}
+
+/* ARENA */
+
+static void *arena_alloc(lisp_ctx_t *context) {
+	arena_t *arena = context->heap->arena;
+	page_t *page = arena->pages;
+	size_t i;
 
-	if(list_entry->mark == 0) {
-		list_entry->mark = 1;
-		
-		if(start->type == lisp_type_pair) {
-			head = lisp_car(start);
-			tail = lisp_cdr(start);
-			mark(head, context);
-			mark(tail, context);
+	if(!page || (page->bump == page->n_cells)) {
+		if((page = make_page(cell_kind_data, context->heap)) == NULL) {
+			fprintf(stderr, "ERROR: Could not allocate new memory page.\n");
+			return NULL;
 		}
-	} 
+		page->arena = 1;
+		page->next = arena->pages;
+		arena->pages = page;
+	}
+
+	i = page->bump++;
+	set_bit(page->alloc_bits, i);
+	page->n_used++;
+	arena->n_cells++;
+
+	context->mem_allocated += page->cell_size;
+	if(context->mem_allocated > context->n_bytes_peak)
+		context->n_bytes_peak = context->mem_allocated;
+
+	return page->cells + i * page->cell_size;
 }
 
-static void sweep(const int req_mark, lisp_ctx_t *context) {
-	alloclist_t *current = context->alloc_list, *buf;
+static void record_escape(const lisp_data_t *obj, arena_t *arena) {
+	lisp_data_t **escapes;
+	size_t size;
 
-	while(current) {
-		buf = current->next;
-		if(current->mark == req_mark)
-			lisp_free_data(current->memory, context);		
-		current = buf;
+	if(arena->escapes_top == arena->escapes_size) {
+		size = arena->escapes_size ? 2 * arena->escapes_size : 64;
+		if((escapes = realloc(arena->escapes, size * sizeof(lisp_data_t*))) == NULL) {
+			fprintf(stderr, "ERROR: Could not record an object escaping the arena.\n");
+			return;
+		}
+		arena->escapes = escapes;
+		arena->escapes_size = size;
 	}
+
+	arena->escapes[arena->escapes_top++] = (lisp_data_t*)obj;
 }
 
-size_t lisp_gc(const int force, lisp_ctx_t *context) {
-	size_t old_mem = context->mem_allocated;
+/* Copies an arena object to the heap, unless that happened already, and
+ * pushes the copy onto the stack of pairs and frames whose fields still need
+ * promoting. The forwarding address is kept like in evacuate(). */
+static lisp_data_t *promote(lisp_data_t *d, lisp_data_t ***stack, size_t *top, size_t *size, lisp_ctx_t *context) {
+	lisp_data_t **grown, *out;
+	page_t *page;
+	size_t i;
+
+	if(!is_heap(d) || !page_of(d)->arena)
+		return d;
+
+	page = page_of(d);
+	i = cell_index(d, page);
+	if(get_bit(page->remembered_bits, i))
+		return (lisp_data_t*)((free_cell_t*)d)->next;
 
-	if((force == LISP_GC_FORCE) || (context->mem_allocated > context->mem_lim_soft)) {
-		clear_mark(context);
-		mark(context->the_global_environment, context);
-		sweep(0, context);
+	if(*top == *size) {
+		*size = *size ? 2 * *size : 256;
+		if((grown = realloc(*stack, *size * sizeof(lisp_data_t*))) == NULL) {
+			fprintf(stderr, "ERROR: Could not promote an object from the arena.\n");
+			return NULL;
+		}
+		*stack = grown;
 	}
 
-	return old_mem - context->mem_allocated;
+	if((out = alloc_cell(cell_kind_data, context)) == NULL)
+		return NULL;
+	*out = *d;
+#ifdef LISP_MEM_DEBUG
+	page_of(out)->file[cell_index(out, page_of(out))] = page->file[i];
+	page_of(out)->line[cell_index(out, page_of(out))] = page->line[i];
+#endif
+	context->mem_list_entries++;
+	context->n_allocs++;
+
+	set_bit(page->remembered_bits, i);
+	((free_cell_t*)d)->next = (free_cell_t*)out;
+
+	if((out->type == lisp_type_pair) || has_fields(out))
+		(*stack)[(*top)++] = out;
+
+	return out;
+}
+
+static void promote_fields(lisp_data_t *obj, lisp_data_t ***stack, size_t *top, size_t *size, lisp_ctx_t *context) {
+	lisp_data_t **slots;
+	unsigned int i;
+
+	if(obj->type == lisp_type_pair) {
+		obj->pair.l = promote(obj->pair.l, stack, top, size, context);
+		obj->pair.r = promote(obj->pair.r, stack, top, size, context);
+		return;
+	}
+	if(obj->type == lisp_type_lexical) {
+		obj->lexical.symbol = promote(obj->lexical.symbol, stack, top, size, context);
+		return;
+	}
+	if(obj->type == lisp_type_global) {
+		obj->global.symbol = promote(obj->global.symbol, stack, top, size, context);
+		obj->global.cell = promote(obj->global.cell, stack, top, size, context);
+		return;
+	}
+	if(obj->type == lisp_type_closure) {
+		obj->closure.lambda = promote(obj->closure.lambda, stack, top, size, context);
+		obj->closure.env = promote(obj->closure.env, stack, top, size, context);
+		return;
+	}
+	if(obj->type == lisp_type_node) {
+		obj->node.a = promote(obj->node.a, stack, top, size, context);
+		obj->node.b = promote(obj->node.b, stack, top, size, context);
+		return;
+	}
+
+	obj->frame.vars = promote(obj->frame.vars, stack, top, size, context);
+	for(slots = lisp_frame_slots(obj), i = 0; i < obj->length; i++)
+		slots[i] = promote(slots[i], stack, top, size, context);
+}
+
+void lisp_arena_begin(lisp_ctx_t *context) {
+	lisp_heap_t *heap = get_heap(context);
+
+	if(!heap || heap->arena)
+		return;
+
+	/* The barrier has no business with the arena while the collector marks. */
+	while(heap->phase != gc_phase_idle)
+		gc_slice(context);
+
+	heap->arena = calloc(1, sizeof(arena_t));
+}
+
+lisp_data_t *lisp_arena_end(lisp_data_t *result, lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	arena_t *arena = heap ? heap->arena : NULL;
+	lisp_data_t **stack = NULL, *d;
+	size_t top = 0, size = 0, n, i, allocs;
+	page_t *page, *buf;
+
+	if(!arena)
+		return result;
+
+	result = promote(result, &stack, &top, &size, context);
+	allocs = context->n_allocs;
+	for(n = 0; n < arena->escapes_top; n++)
+		promote_fields(arena->escapes[n], &stack, &top, &size, context);
+	/* Everything older objects can reach from the arena hangs off an
+	 * escape, so only these promotions move objects others point to. */
+	if(context->n_allocs != allocs)
+		context->n_moves++;
+	while(top)
+		promote_fields(stack[--top], &stack, &top, &size, context);
+	free(stack);
+	forward_symbols(1, heap);
+
+	for(page = arena->pages; page; page = buf) {
+		buf = page->next;
+		for(i = 0; i < page->bump; i++) {
+			d = (lisp_data_t*)(page->cells + i * page->cell_size);
+			if(!get_bit(page->remembered_bits, i))
+				uncount_slots(free_contents(d), context);
+		}
+		free_page(page);
+	}
+
+	context->mem_allocated -= arena->n_cells * cell_sizes[cell_kind_data];
+	context->mem_list_entries -= arena->n_cells;
+	context->n_frees += arena->n_cells;
+
+	free(arena->escapes);
+	free(arena);
+	heap->arena = NULL;
+
+	return result;
 }
 
 /* FREE */
 
 void lisp_free_data_rec(lisp_data_t *in, lisp_ctx_t *context) {
-	clear_mark(context);
-	mark(in, context);
-	sweep(1, context);
+	lisp_heap_t *heap = context->heap;
+	page_t *page;
+
+	if(!heap)
+		return;
+
+	abort_cycle(heap);
+	complete_sweep(context);
+	clear_mark(heap);
+	mark(in, heap);
+	purge_symbols(1, heap);
+
+	for(page = heap->pages[cell_kind_data]; page; page = page->next)
+		sweep_page(page, 1, context);
+
+	clear_mark(heap);
+	rebuild_page_lists(heap);
+	free_spare_pages(0, heap);
+}
+
+void lisp_free_heap(lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	page_t *page, *buf;
+	int kind;
+
+	if(!heap)
+		return;
+
+	/* Nothing survives the heap, so the escapes of an open arena are not
+	 * promoted into pages about to be freed. */
+	if(heap->arena) {
+		heap->arena->escapes_top = 0;
+		lisp_arena_end(NULL, context);
+	}
+
+	for(kind = 0; kind < n_cell_kinds; kind++) {
+		page = heap->pages[kind];
+		while(page) {
+			buf = page->next;
+			free_page(page);
+			page = buf;
+		}
+	}
+	free_spare_pages(0, heap);
+
+	lisp_alloc_profile_reset(context);
+	free_strings(heap);
+	free(heap->symbols);
+	free(heap->table);
+	free(heap->mark_stack);
+	free(heap->remembered);
+	free(heap);
+	context->heap = NULL;
 }
 
 /* INFO */
 
+static void print_pauses(FILE *fp, lisp_gc_info_t *info) {
+	size_t i;
+
+	fprintf(fp, "%lu collections, %lu of them full, in %lu pauses of %lu us total and %lu us max.\n",
+		info->n_collections, info->n_full_collections, info->n_pauses, info->pause_us_total, info->pause_us_max);
+	for(i = 0; i < LISP_GC_PAUSE_BUCKETS; i++) {
+		if(!info->pause_histogram[i])
+			continue;
+		if(i == LISP_GC_PAUSE_BUCKETS - 1)
+			fprintf(fp, "  >= %8lu us: %lu\n", (size_t)1 << (i - 1), info->pause_histogram[i]);
+		else
+			fprintf(fp, "  <  %8lu us: %lu\n", (size_t)1 << i, info->pause_histogram[i]);
+	}
+}
+
 void lisp_gc_stats(FILE *fp, lisp_ctx_t *context) {
-	alloclist_t *current = context->alloc_list, *buf;
+	lisp_heap_t *heap = context->heap;
+#ifdef LISP_MEM_DEBUG
+	page_t *page;
+	size_t i;
+#endif
 
 	if((context->n_allocs != context->n_frees) || (context->mem_verbosity == LISP_GC_VERBOSE)) {
 		printf("\n--- Memory usage summary ---\n");
+#ifdef LISP_MEM_DEBUG
 		if(context->n_frees < context->n_allocs) {
 			fprintf(fp, "Showing unfreed memory:\n");
-			while(current) {
-				fprintf(fp, "%s, %d\n", current->file, current->line);
-				buf = current;
-				current = current->next;
-				free(buf);
-			}
+			for(page = context->heap->pages[cell_kind_data]; page; page = page->next)
+				for(i = 0; i < page->bump; i++)
+					if(get_bit(page->alloc_bits, i))
+						fprintf(fp, "%s, %d\n", page->file[i], page->line[i]);
 		}
+#endif
 
 		fprintf(fp, "%lu allocs; %lu frees.\n", context->n_allocs, context->n_frees);
+		if(heap && heap->n_full_gcs) {
+			fprintf(fp, "%lu full collections on %lu threads in %lu us.\n", heap->n_full_gcs, context->gc_threads > 1 ? context->gc_threads : 1, (size_t)heap->full_gc_us);
+			fprintf(fp, "%lu bytes marked, %lu bytes swept", heap->bytes_marked, heap->bytes_swept);
+			if(heap->full_gc_us)
+				fprintf(fp, " (%.1f MB/s)", (heap->bytes_marked + heap->bytes_swept) / (double)heap->full_gc_us);
+			fprintf(fp, ".\n");
+		}
+		if(context->gc_info.n_pauses && (context->mem_verbosity == LISP_GC_VERBOSE))
+			print_pauses(fp, &context->gc_info);
+		if(heap && heap->string_reserved && (context->mem_verbosity == LISP_GC_VERBOSE))
+			fprintf(fp, "%lu bytes reserved for strings.\n", heap->string_reserved);
 		if(context->mem_list_entries)
 			printf("%lu list entries left.\n", context->mem_list_entries);
 		printf("--- End summary ---\n");
@@ -263,3 +2546,61 @@ void lisp_gc_stats(FILE *fp, lisp_ctx_t *context) {
 	if((context->mem_verbosity == LISP_GC_VERBOSE) || context->mem_allocated)
 		fprintf(fp, "%lu bytes peak memory usage.\n", context->n_bytes_peak);
 }
+
+void lisp_alloc_profile(FILE *fp, lisp_ctx_t *context) {
+	sample_t **samples;
+	size_t i, n;
+
+	if((samples = sorted_samples(context->heap, &n)) == NULL)
+		return;
+
+	fprintf(fp, "\n--- Allocation profile, one sample per %lu bytes ---\n", context->alloc_sample_bytes);
+	fprintf(fp, "%12s %10s  %-24s %s\n", "bytes", "objects", "procedure", "allocated at");
+	for(i = 0; i < n; i++)
+		fprintf(fp, "%12lu %10lu  %-24s %s:%d\n", samples[i]->bytes, samples[i]->objects,
+			*samples[i]->proc ? samples[i]->proc : "(top level)", samples[i]->file, samples[i]->line);
+	fprintf(fp, "--- End profile ---\n");
+
+	free(samples);
+}
+
+lisp_data_t *lisp_alloc_profile_list(lisp_ctx_t *context) {
+	lisp_data_t *out = NULL, *entry, *proc;
+	sample_t **samples;
+	size_t n;
+
+	if((samples = sorted_samples(context->heap, &n)) == NULL)
+		return NULL;
+
+	while(n--) {
+		proc = *samples[n]->proc ? lisp_make_symbol(samples[n]->proc, context) : LISP_FALSE;
+		entry = lisp_cons(lisp_make_int(samples[n]->objects, context), NULL);
+		entry = lisp_cons(lisp_make_int(samples[n]->bytes, context), entry);
+		entry = lisp_cons(lisp_make_int(samples[n]->line, context), entry);
+		entry = lisp_cons(lisp_make_string(samples[n]->file, context), entry);
+		out = lisp_cons(lisp_cons(proc, entry), out);
+	}
+
+	free(samples);
+	return out;
+}
+
+void lisp_alloc_profile_reset(lisp_ctx_t *context) {
+	lisp_heap_t *heap = context->heap;
+	sample_t *sample, *buf;
+	size_t i;
+
+	if(!heap)
+		return;
+
+	for(i = 0; i < SAMPLE_BUCKETS; i++) {
+		for(sample = heap->samples[i]; sample; sample = buf) {
+			buf = sample->next;
+			free(sample->proc);
+			free(sample);
+		}
+		heap->samples[i] = NULL;
+	}
+	heap->n_samples = 0;
+	heap->sample_left = context->alloc_sample_bytes;
+}
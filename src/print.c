@@ -22,19 +22,20 @@ static void print_data_rec(const lisp_data_t *d, int print_parens, lisp_ctx_t *c
 	else if(d == context->the_global_environment)
 		printf("<env>");
 	else {
-		switch(d->type) {
+		switch(lisp_type_of(d)) {
 			case lisp_type_prim: printf("<proc>"); break;
-			case lisp_type_integer: printf("%d", d->integer); break;
+			case lisp_type_integer: printf("%d", lisp_int_value(d)); break;
 			case lisp_type_decimal: printf("%g", d->decimal); break;
-			case lisp_type_symbol: printf("%s", d->symbol); break;
-			case lisp_type_string: printf("\"%s\"", d->string); break;
-			case lisp_type_error: printf("ERROR: '%s'", d->error); break;
+			case lisp_type_symbol: printf("%s", lisp_text(d)); break;
+			case lisp_type_string: printf("\"%s\"", lisp_text(d)); break;
+			case lisp_type_error: printf("ERROR: '%s'", lisp_text(d)); break;
+			case lisp_type_boolean: printf((d == LISP_TRUE) ? "#t" : "#f"); break;
+			case lisp_type_lexical: printf("<lexical %u %u>", d->lexical.depth, d->lexical.slot); break;
+			case lisp_type_frame: printf("<frame>"); break;
+			case lisp_type_global: printf("%s", lisp_text(d->global.symbol)); break;
+			case lisp_type_closure: printf("<proc>"); break;
+			case lisp_type_node: printf("<node>"); break;
 			case lisp_type_pair:
-				if(is_compound_procedure(d)) {
-					printf("<proc>");
-					break;
-				}
-
 				if(print_parens)
 					printf("(");
 
@@ -43,7 +44,7 @@ static void print_data_rec(const lisp_data_t *d, int print_parens, lisp_ctx_t *c
 
 				if(tail) {
 					print_data_rec(head, 1, context);
-					if(tail->type != lisp_type_pair) {
+					if(lisp_type_of(tail) != lisp_type_pair) {
 						printf(" . ");
 						print_data_rec(tail, 1, context);
 					} else {
@@ -190,20 +190,14 @@ static lisp_data_t *read_subexp(const char *exp, size_t already_quoted, size_t *
 	} else if(is_integer(exp, readto, &integer)) {		
 		out = lisp_make_int(integer, context);
 	} else if(is_string(exp, readto)) {
-		if((buf = malloc(*readto - 1)) == NULL)
-			return NULL;
-		
-		strncpy(buf, exp + 1, *readto - 2);
-		buf[*readto - 2] = '\0';
-		out = lisp_make_string(buf, context);		
-		free(buf);		
+		out = lisp_make_string_n(exp + 1, *readto - 2, context);
 	} else if(is_symbol(exp, readto)) {		
-		if((buf = malloc(*readto + 1)) == NULL)
-			return NULL;
-		strncpy(buf, exp, *readto);
-		buf[*readto] = '\0';
-		out = lisp_make_symbol(buf, context);
-		free(buf);
+		if((*readto == 2) && !strncmp(exp, "#t", 2))
+			out = LISP_TRUE;
+		else if((*readto == 2) && !strncmp(exp, "#f", 2))
+			out = LISP_FALSE;
+		else
+			out = lisp_make_symbol_n(exp, *readto, context);
 	} else if(is_combination(exp, readto)) {
 		if(is_empty_combination(exp)) {			
 			out = NULL;
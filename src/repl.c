@@ -110,7 +110,7 @@ int main(void) {
 
 	printf("Setting up the global environment...\n\n");
 
-	context = lisp_make_context(1024 * 768, 1024 * 1024, LISP_GC_SILENT, 60);
+	context = lisp_make_context(1024 * 768, 1024 * 1024, LISP_GC_SILENT, 60, 1);
 	lisp_setup_env(context);
 	print_banner();
 
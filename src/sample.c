@@ -34,7 +34,7 @@ int main(void) {
 	 ************************************************/
 
 	/* Create a new empty context */
-	context = lisp_make_context(1024 * 768, 1024 * 1024, LISP_GC_VERBOSE, 60);
+	context = lisp_make_context(1024 * 768, 1024 * 1024, LISP_GC_VERBOSE, 60, 1);
 
 	/* Add a CVAR and a primitive procedure */
 	lisp_add_cvar("my-guess", &sample_cvar, LISP_CVAR_RW, context);
@@ -0,0 +1,89 @@
+/*
+ * libisp -- Lisp evaluator based on SICP
+ * (C) 2013-2017 Martin Wolters
+ *
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+/* Regression tests. Each test returns 0 if it passed and prints what went
+ * wrong otherwise. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libisp.h"
+
+#define N_LISTS		12
+#define LIST_CELLS	2000
+#define MAX_GLOBALS	100000
+
+static lisp_data_t *eval_string(const char *exp, lisp_ctx_t *context) {
+	int error = 0;
+	lisp_data_t *exp_list = lisp_read(exp, NULL, &error, context);
+
+	if(error)
+		return NULL;
+	return lisp_eval_thread(exp_list, context);
+}
+
+/* Defines globals until the hard limit aborts one of the definitions. The
+ * globals defined before must still hold their own values. */
+static int test_define_at_limit(void) {
+	lisp_ctx_t *context;
+	lisp_data_t *ret;
+	char exp[64];
+	int i, n_defined, failed = 0;
+
+	context = lisp_make_context(500000, 1000000, LISP_GC_SILENT, 0, 1);
+	lisp_setup_env(context);
+
+	lisp_run("(define (make-list n) (if (= n 0) nil (cons n (make-list (- n 1)))))", context);
+	for(i = 0; i < N_LISTS; i++) {
+		sprintf(exp, "(define list-%d (make-list %d))", i, LIST_CELLS);
+		lisp_run(exp, context);
+	}
+
+	for(n_defined = 0; n_defined < MAX_GLOBALS; n_defined++) {
+		sprintf(exp, "(define global-%d %d)", n_defined, n_defined);
+		if(lisp_type_of(eval_string(exp, context)) == lisp_type_error)
+			break;
+	}
+	if(n_defined == MAX_GLOBALS) {
+		printf("define at limit: the hard limit was never reached\n");
+		lisp_destroy_context(context);
+		return 1;
+	}
+
+	/* Looking the globals up needs room as well. */
+	context->mem_lim_hard *= 4;
+	for(i = 0; (i < n_defined) && !failed; i++) {
+		sprintf(exp, "global-%d", i);
+		ret = eval_string(exp, context);
+		if((lisp_type_of(ret) != lisp_type_integer) || (lisp_int_value(ret) != i)) {
+			printf("define at limit: global-%d lost its value after %d definitions\n", i, n_defined);
+			failed = 1;
+		}
+	}
+
+	lisp_destroy_context(context);
+
+	return failed;
+}
+
+int main(void) {
+	int failed = 0;
+
+	failed += test_define_at_limit();
+
+	if(failed) {
+		printf("%d test(s) failed\n", failed);
+		return EXIT_FAILURE;
+	}
+
+	printf("all tests passed\n");
+	return EXIT_SUCCESS;
+}
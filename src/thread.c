@@ -21,6 +21,7 @@
 #include <stdio.h>
 
 #include "libisp/defs.h"
+#include "libisp/data.h"
 #include "libisp/eval.h"
 #include "libisp/mem.h"
 
@@ -35,20 +36,49 @@ static DWORD WINAPI thread(LPVOID in) {
 static void *thread(void *in) {
 #endif
 	threadparam_t *param = (threadparam_t*)in;
+	lisp_ctx_t *context = param->context;
+	lisp_data_t * volatile exp = param->exp;
+	jmp_buf unwind;
+	size_t reclaimed;
 
-	param->result = lisp_eval(param->exp, param->context);
-	param->context->thread_running = 0;
+	/* Collections during the evaluation keep exp and everything the
+	 * evaluator references from this thread's stack alive. */
+	lisp_gc_set_stack((const void*)&exp, context);
+	context->eval_proc = NULL;
+	if(context->eval_arena)
+		lisp_arena_begin(context);
+	if(!setjmp(unwind)) {
+		context->eval_unwind = &unwind;
+		param->result = lisp_arena_end(lisp_eval(exp, context), context);
+	} else if(context->eval_plz_die) {
+		/* The evaluation timed out and the evaluator jumped back here. */
+		context->eval_unwind = NULL;
+		context->eval_plz_die = 0;
+		lisp_arena_end(NULL, context);
+		param->result = NULL;
+	} else {
+		/* The allocator ran out of memory and jumped back here. Everything
+		 * the evaluation allocated is garbage now. */
+		context->eval_unwind = NULL;
+		lisp_arena_end(NULL, context);
+		if((reclaimed = lisp_gc(LISP_GC_FORCE, context)) && (context->mem_verbosity == LISP_GC_VERBOSE))
+			printf("-- GC: %zu bytes of memory reclaimed.\n", reclaimed);
+		param->result = lisp_make_error("MEMORY -- Hard memory limit reached", context);
+	}
+	context->eval_unwind = NULL;
+	lisp_gc_set_stack(NULL, context);
+	context->thread_running = 0;
 #ifndef _WIN32
 	pthread_exit(NULL);
 #endif
 	return 0;
 }
 
-static void kill_thread(threadparam_t *info, const char *msg, HANDLE thread_handle, lisp_ctx_t *context) {
+/* The evaluation stops at its next step and cleans up after itself before
+ * the thread ends, so the next evaluation can't run alongside it. */
+static void kill_thread(const char *msg, lisp_ctx_t *context) {
 	context->eval_plz_die = 1;
 	fprintf(stderr, "%s", msg);
-	info->result = NULL;
-	context->thread_running = 0;
 }
 
 static HANDLE spawn_thread(threadparam_t *param) {
@@ -68,25 +98,24 @@ static HANDLE spawn_thread(threadparam_t *param) {
 }
 
 lisp_data_t *lisp_eval_thread(const lisp_data_t *exp, lisp_ctx_t *context) {
-	HANDLE thread_handle;
 	threadparam_t info;
 	time_t starttime = time(NULL);
-	size_t reclaimed;
+	int killed = 0;
 
 	info.exp = (lisp_data_t*)exp;
 	info.context = context;
 	context->thread_running = 1;
+	context->eval_plz_die = 0;
 
-	thread_handle = spawn_thread(&info);
+	if(!spawn_thread(&info)) {
+		context->thread_running = 0;
+		return NULL;
+	}
 
 	while(context->thread_running) {
-		if(context->thread_timeout && (time(NULL) - starttime > context->thread_timeout))
-			kill_thread(&info, "-- ERROR: eval() timed out.\n", thread_handle, context);
-		if(context->mem_allocated + sizeof(lisp_data_t) >= context->mem_lim_hard) {
-			kill_thread(&info, "-- ERROR: Hard memory limit reached.\n", 
-				thread_handle, context);
-			if((context->mem_verbosity == LISP_GC_VERBOSE) && (reclaimed = lisp_gc(LISP_GC_FORCE, context)))
-				printf("-- GC: %zu bytes of memory reclaimed.\n", reclaimed);			
+		if(!killed && context->thread_timeout && (time(NULL) - starttime > context->thread_timeout)) {
+			kill_thread("-- ERROR: eval() timed out.\n", context);
+			killed = 1;
 		}
 	}
 